@@ -0,0 +1,31 @@
+#include "bench.h"
+#include "lib/print.h"
+#include "proc.h"
+
+/* user_bench.S */
+extern uint8_t proc_bench_start[];
+extern uint8_t proc_bench_end[];
+
+static const char *bench_names[BENCH_COUNT] = {
+    [BENCH_NULL_SYSCALL] = "null syscall",
+    [BENCH_GETPID] = "getpid",
+    [BENCH_RDTIME] = "rdtime",
+};
+
+void user_bench_start(void) {
+  uint64_t size = (uint64_t)proc_bench_end - (uint64_t)proc_bench_start;
+  if (!result_is_ok(proc_from_code(proc_bench_start, size, "bench")))
+    printf("bench: failed to create proc\n", PRINT_FLAG_BOTH);
+}
+
+g_bool bench_report(uint64_t id, uint64_t iters, uint64_t total_cycles,
+                    uint64_t min_cycles) {
+  if (id >= BENCH_COUNT || iters == 0)
+    return false;
+
+  printf("bench %{type: str}: %{type: int} cycles/iter, min %{type: int} "
+         "(%{type: int} iterations)\n",
+         PRINT_FLAG_BOTH, bench_names[id], total_cycles / iters, min_cycles,
+         iters);
+  return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+/*
+ * U-mode trap path microbenchmarks.
+ *
+ * user_bench.S runs each benchmark for BENCH_ITERS iterations, timing every
+ * iteration with rdcycle, and hands the sum and the fastest iteration to
+ * SYS_BENCH_RESULT. The kernel prints them as cycles per iteration:
+ *
+ *   BENCH_NULL_SYSCALL  ecall to a syscall that does nothing: uservec,
+ *                       usertrap, syscall dispatch and user_trap_ret
+ *   BENCH_GETPID        the same with a syscall that reads the proc
+ *   BENCH_RDTIME        rdtime, which does not trap since scheduler()
+ *                       sets scounteren.TM on every hart, as a floor for
+ *                       the other two
+ *
+ * Included from user_bench.S, so only macros outside __ASSEMBLER__.
+ */
+
+#define BENCH_NULL_SYSCALL 0
+#define BENCH_GETPID 1
+#define BENCH_RDTIME 2
+#define BENCH_COUNT 3
+
+#define BENCH_ITERS 1024
+
+#ifndef __ASSEMBLER__
+
+#include <lib/types.h>
+#include <stdint.h>
+
+/*
+ * Starts the benchmark proc, which prints its results and the kernel
+ * statistics (SYS_STATS), then exits.
+ */
+void user_bench_start(void);
+
+/* Records and prints one benchmark result, see SYS_BENCH_RESULT. */
+g_bool bench_report(uint64_t id, uint64_t iters, uint64_t total_cycles,
+                    uint64_t min_cycles);
+
+#endif
@@ -65,6 +65,14 @@ G_INLINE void shared_uart_puts(const char *s) {
   uart_puts(shared_uart, s);
 }
 
+// for code that will not see another interrupt, see uart_set_polled()
+G_INLINE void shared_uart_set_polled(void) {
+  if (!shared_uart_initialized) {
+    return;
+  }
+  uart_set_polled(shared_uart);
+}
+
 G_INLINE g_char shared_uart_getc(void) {
   if (!shared_uart_initialized) {
     return 0;
@@ -7,8 +7,19 @@
 #define LINE_STATUS_REGISTER 0x5
 #define LINE_CONTROL_REGISTER 0x3
 #define FIFO_CONTROL_REGISTER 0x2
+#define INTERRUPT_IDENT_REGISTER 0x2 // the same offset, when read
 #define INTERRUPT_ENABLE_REGISTER 0x1
 #define LINE_STATUS_DATA_READY 0x1
+#define LINE_STATUS_THR_EMPTY 0x20
+
+#define IER_RX_AVAILABLE 0x1
+#define IER_THR_EMPTY 0x2
+
+#define IIR_NO_INTERRUPT 0x1
+#define IIR_ID_MASK 0xe
+#define IIR_THR_EMPTY 0x2
+
+#define UART_TX_FIFO_SIZE 16
 
 /**
  * Creates a new UART device.
@@ -22,6 +33,17 @@ RESULT_TYPE(*uart_t) make_uart(uint64_t base) {
   }
   uart->base = base;
   uart->is_initialized = false;
+  uart->ier = 0;
+
+  initlock(&uart->tx_lock, "uart_tx");
+  uart->tx_head = uart->tx_tail = 0;
+  uart->tx_irq = false;
+  uart->tx_polled = false;
+  uart->tx_full_waits = 0;
+
+  initlock(&uart->rx_lock, "uart_rx");
+  uart->rx_tail = uart->rx_committed = uart->rx_head = 0;
+  uart->rx_overruns = 0;
 
   return RESULT_SUCCESS(uart);
 }
@@ -43,34 +65,99 @@ g_bool uart_init(uart_t *uart) {
   volatile uint8_t *u = (volatile uint8_t *)uart->base;
   u[LINE_CONTROL_REGISTER] = 0x3;
   u[FIFO_CONTROL_REGISTER] = 0x1;
-  u[INTERRUPT_ENABLE_REGISTER] = 0x1;
+  uart->ier = IER_RX_AVAILABLE;
+  u[INTERRUPT_ENABLE_REGISTER] = uart->ier;
   uart->is_initialized = true;
   return true;
 }
 
-void uart_putc(uart_t *uart, g_char c) {
+/* waits for room in the transmitter, then writes `c` */
+static void uart_putc_polled(uart_t *uart, g_char c) {
+  volatile uint8_t *u = (volatile uint8_t *)uart->base;
+
+  while (!(u[LINE_STATUS_REGISTER] & LINE_STATUS_THR_EMPTY))
+    ;
+  u[0] = c;
+}
+
+static void uart_set_ier(uart_t *uart, uint8_t ier) {
+  if (uart->ier == ier)
+    return;
+
+  volatile uint8_t *u = (volatile uint8_t *)uart->base;
+  uart->ier = ier;
+  u[INTERRUPT_ENABLE_REGISTER] = ier;
+}
+
+/*
+ * Moves up to a FIFO's worth of the ring into the transmitter if it is empty,
+ * and leaves the THR-empty interrupt on while bytes remain. Called with
+ * tx_lock held.
+ */
+static void uart_tx_fill(uart_t *uart) {
+  volatile uint8_t *u = (volatile uint8_t *)uart->base;
+
+  if (u[LINE_STATUS_REGISTER] & LINE_STATUS_THR_EMPTY) {
+    for (int i = 0; i < UART_TX_FIFO_SIZE && uart->tx_tail != uart->tx_head;
+         i++) {
+      u[0] = uart->tx_ring[uart->tx_tail % UART_TX_RING_SIZE];
+      uart->tx_tail++;
+    }
+  }
+
+  if (uart->tx_tail != uart->tx_head)
+    uart_set_ier(uart, uart->ier | IER_THR_EMPTY);
+  else
+    uart_set_ier(uart, uart->ier & ~IER_THR_EMPTY);
+}
+
+/* writes `len` bytes of `s`, `len` < 0 for a NUL-terminated string */
+static void uart_write(uart_t *uart, const char *s, int64_t len) {
   if (!uart->is_initialized) {
     return;
   }
 
-  volatile uint8_t *u = (volatile uint8_t *)uart->base;
-  u[0] = c;
+  if (!uart->tx_irq || uart->tx_polled) {
+    for (int64_t i = 0; len < 0 ? s[i] != 0 : i < len; i++)
+      uart_putc_polled(uart, s[i]);
+    return;
+  }
 
-  // clear the interrupt
-  (void)u[LINE_STATUS_REGISTER];
+  acquire(&uart->tx_lock);
+  for (int64_t i = 0; len < 0 ? s[i] != 0 : i < len; i++) {
+    if (uart->tx_head - uart->tx_tail == UART_TX_RING_SIZE) {
+      // full: push the oldest bytes out ourselves rather than lose any
+      uart->tx_full_waits++;
+      while (uart->tx_head - uart->tx_tail == UART_TX_RING_SIZE)
+        uart_tx_fill(uart);
+    }
+    uart->tx_ring[uart->tx_head % UART_TX_RING_SIZE] = s[i];
+    uart->tx_head++;
+  }
+  uart_tx_fill(uart);
+  release(&uart->tx_lock);
 }
 
+void uart_putc(uart_t *uart, g_char c) { uart_write(uart, &c, 1); }
+
 void uart_puts(uart_t *uart, const char *s) {
   if (!s) {
     return;
   }
 
-  if (!uart->is_initialized) {
+  uart_write(uart, s, -1);
+}
+
+void uart_set_polled(uart_t *uart) {
+  if (!uart->is_initialized || uart->tx_polled) {
     return;
   }
 
-  while (*s) {
-    uart_putc(uart, *s++);
+  // the lock holder may be the code that panicked, so do without it
+  uart->tx_polled = true;
+  while (uart->tx_tail != uart->tx_head) {
+    uart_putc_polled(uart, uart->tx_ring[uart->tx_tail % UART_TX_RING_SIZE]);
+    uart->tx_tail++;
   }
 }
 
@@ -88,13 +175,103 @@ unsigned char uart_getc(uart_t *uart) {
   return u[0];
 }
 
+/* the line discipline, for one received byte. Called with rx_lock held. */
+static void uart_rx_input(uart_t *uart, char c) {
+  if (c == '\r')
+    c = '\n';
+
+  if (c == 0x7f || c == '\b') {
+    // only the line being typed can still be edited
+    if (uart->rx_head != uart->rx_committed) {
+      uart->rx_head--;
+      uart_write(uart, "\b \b", -1);
+    }
+    return;
+  }
+
+  if (uart->rx_head - uart->rx_tail == UART_RX_RING_SIZE) {
+    uart->rx_overruns++;
+    // a line that fills the ring would never be readable, hand it over
+    uart->rx_committed = uart->rx_head;
+    return;
+  }
+
+  uart->rx_ring[uart->rx_head % UART_RX_RING_SIZE] = c;
+  uart->rx_head++;
+  uart_write(uart, &c, 1);
+
+  if (c == '\n')
+    uart->rx_committed = uart->rx_head;
+}
+
+uint32_t uart_readable(uart_t *uart) {
+  return uart->rx_committed - uart->rx_tail;
+}
+
+uint32_t uart_read(uart_t *uart, char *buf, uint32_t len) {
+  uint32_t n = 0;
+
+  acquire(&uart->rx_lock);
+  while (n < len && uart->rx_tail != uart->rx_committed) {
+    char c = uart->rx_ring[uart->rx_tail % UART_RX_RING_SIZE];
+    uart->rx_tail++;
+    buf[n++] = c;
+    if (c == '\n')
+      break;
+  }
+  release(&uart->rx_lock);
+
+  return n;
+}
+
+uint32_t uart_handle_irq(uart_t *uart) {
+  if (!uart->is_initialized) {
+    return 0;
+  }
+
+  volatile uint8_t *u = (volatile uint8_t *)uart->base;
+  uint32_t readable = 0;
+
+  for (;;) {
+    uint8_t iir = u[INTERRUPT_IDENT_REGISTER]; // reading clears THR-empty
+    if (iir & IIR_NO_INTERRUPT)
+      break;
+
+    if ((iir & IIR_ID_MASK) == IIR_THR_EMPTY) {
+      acquire(&uart->tx_lock);
+      if (!uart->tx_polled)
+        uart_tx_fill(uart);
+      release(&uart->tx_lock);
+      continue;
+    }
+
+    // receive data, timeout or line status: take the whole FIFO in one go
+    // so the line doesn't re-assert immediately
+    (void)u[LINE_STATUS_REGISTER];
+    acquire(&uart->rx_lock);
+    uint32_t before = uart->rx_committed;
+    while (u[LINE_STATUS_REGISTER] & LINE_STATUS_DATA_READY) {
+      uart_rx_input(uart, u[0]);
+    }
+    readable += uart->rx_committed - before;
+    release(&uart->rx_lock);
+  }
+
+  return readable;
+}
+
 void uart_enable_interrupts(uart_t *uart) {
   if (!uart->is_initialized) {
     return;
   }
 
   volatile uint8_t *u = (volatile uint8_t *)uart->base;
-  u[INTERRUPT_ENABLE_REGISTER] = 0x1;
+
+  acquire(&uart->tx_lock);
+  uart->ier = 0; // force the write
+  uart_set_ier(uart, IER_RX_AVAILABLE);
+  uart->tx_irq = true;
+  release(&uart->tx_lock);
 
   (void)u[LINE_STATUS_REGISTER];
   (void)u[INTERRUPT_ENABLE_REGISTER];
@@ -106,6 +283,14 @@ void uart_disable_interrupts(uart_t *uart) {
     return;
   }
 
-  volatile uint8_t *u = (volatile uint8_t *)uart->base;
-  u[INTERRUPT_ENABLE_REGISTER] = 0x0;
+  // back to synchronous output, nothing would drain the ring
+  acquire(&uart->tx_lock);
+  uart->tx_irq = false;
+  while (uart->tx_tail != uart->tx_head) {
+    uart_putc_polled(uart, uart->tx_ring[uart->tx_tail % UART_TX_RING_SIZE]);
+    uart->tx_tail++;
+  }
+  uart->ier = 0xff; // force the write
+  uart_set_ier(uart, 0);
+  release(&uart->tx_lock);
 }
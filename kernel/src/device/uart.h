@@ -1,17 +1,49 @@
 #pragma once
 
 #include "lib/result.h"
+#include <lib/spinlock.h>
 #include <lib/types.h>
 #include <stdint.h>
 
+/* bytes buffered for transmission, a power of two */
+#define UART_TX_RING_SIZE 2048
+
+/* bytes of received input buffered, a power of two */
+#define UART_RX_RING_SIZE 1024
+
 /**
  * UART device structure.
  * This structure holds the base address of the UART device and a flag
  * indicating whether the device has been initialized.
+ *
+ * Output goes through a transmit ring: writers only enqueue, and the
+ * THR-empty interrupt moves up to a FIFO's worth of bytes to the device at a
+ * time. Until uart_enable_interrupts(), and for good after
+ * uart_set_polled(), output is written synchronously instead.
+ *
+ * Input goes through a line discipline into a receive ring: bytes are echoed,
+ * CR becomes LF and backspace edits the line being typed. A line becomes
+ * readable once it is ended or fills the ring.
  */
 typedef struct {
   uint64_t base;
   g_bool is_initialized;
+  uint8_t ier; /* interrupt enable register as last written */
+
+  struct spinlock tx_lock;
+  char tx_ring[UART_TX_RING_SIZE];
+  uint32_t tx_head;      /* next byte to enqueue */
+  uint32_t tx_tail;      /* next byte to send */
+  g_bool tx_irq;         /* the THR-empty interrupt drains the ring */
+  g_bool tx_polled;      /* synchronous output only, see uart_set_polled() */
+  uint64_t tx_full_waits; /* writes that found the ring full */
+
+  struct spinlock rx_lock;
+  char rx_ring[UART_RX_RING_SIZE];
+  uint32_t rx_tail;      /* next byte to read */
+  uint32_t rx_committed; /* end of the completed lines */
+  uint32_t rx_head;      /* end of the line being typed */
+  uint64_t rx_overruns;  /* bytes dropped with the ring full */
 } uart_t;
 
 /**
@@ -31,5 +63,27 @@ g_bool uart_init(uart_t *uart);
 void uart_putc(uart_t *uart, g_char c);
 g_char uart_getc(uart_t *uart);
 void uart_puts(uart_t *uart, const char *);
+/*
+ * Interrupt handler: refills the transmit FIFO from the ring and feeds the
+ * receive FIFO through the line discipline. Returns how many bytes became
+ * readable.
+ */
+uint32_t uart_handle_irq(uart_t *uart);
+
+/*
+ * Moves up to `len` readable bytes to `buf`, stopping after the end of a
+ * line. Does not block; returns the number of bytes moved.
+ */
+uint32_t uart_read(uart_t *uart, char *buf, uint32_t len);
+
+/* Bytes uart_read() could return now. The caller holds rx_lock. */
+uint32_t uart_readable(uart_t *uart);
+
+/*
+ * Switches to synchronous output for good, first writing out whatever the
+ * ring holds without taking its lock. For panics and other dead ends that
+ * will never see another interrupt.
+ */
+void uart_set_polled(uart_t *uart);
 void uart_enable_interrupts(uart_t *uart);
 void uart_disable_interrupts(uart_t *uart);
@@ -7,6 +7,8 @@
 #include <lib/panic.h>
 #include <lib/print.h>
 
+static void virtio_keyboard_work(void *arg);
+
 RESULT_TYPE(virtio_keyboard_t *)
 make_virtio_keyboard(uint64_t base, uint32_t irq) {
   virtio_keyboard_t *kbd = (virtio_keyboard_t *)alloc_page();
@@ -17,6 +19,11 @@ make_virtio_keyboard(uint64_t base, uint32_t irq) {
   kbd->vdev.irq = irq;
   kbd->vdev.is_initialized = false;
 
+  kbd->modifiers = 0;
+  kbd->pending_head = kbd->pending_tail = 0;
+  kbd->dropped = 0;
+  work_init(&kbd->work, virtio_keyboard_work, kbd);
+
   /* ➜ NEW: populate static status packet */
   kbd->status_pkt = (struct virtio_keyboard_status_pkt){
       .select = 1, .reserved = 0, .size = 1, .data = 1 /* DRIVER_OK */
@@ -89,12 +96,80 @@ static const char *key_state_str(uint16_t state) {
   }
 }
 
+/* bottom half: turns the queued key events into keypresses, runs in kworker */
+static void virtio_keyboard_work(void *arg) {
+  virtio_keyboard_t *kbd = arg;
+
+  uint32_t tail = kbd->pending_tail;
+  while (tail != __atomic_load_n(&kbd->pending_head, __ATOMIC_ACQUIRE)) {
+    struct virtio_input_event *ev =
+        &kbd->pending[tail % VIRTIO_KEYBOARD_PENDING_NUM];
+
+    switch (ev->code) {
+    case KEY_CAPSLOCK:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_CAPSLOCK,
+                            ev->value == KEY_PRESSED);
+      break;
+    case KEY_LEFTALT:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_LALT,
+                            ev->value == KEY_PRESSED);
+      break;
+    case KEY_RIGHTALT:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_RALT,
+                            ev->value == KEY_PRESSED);
+      break;
+    case KEY_LEFTCTRL:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_LCTRL,
+                            ev->value == KEY_PRESSED);
+      break;
+    case KEY_RIGHTCTRL:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_RCTRL,
+                            ev->value == KEY_PRESSED);
+      break;
+    case KEY_LEFTSHIFT:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_LSHIFT,
+                            ev->value == KEY_PRESSED);
+      break;
+    case KEY_RIGHTSHIFT:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_RSHIFT,
+                            ev->value == KEY_PRESSED);
+      break;
+    case KEY_LEFTMETA:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_LMETA,
+                            ev->value == KEY_PRESSED);
+      break;
+    case KEY_RIGHTMETA:
+      KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_RMETA,
+                            ev->value == KEY_PRESSED);
+      break;
+
+    default:
+      result_t rkp = make_keypress(ev->code, kbd->modifiers, ev->value);
+
+      if (!result_is_ok(rkp)) {
+        printf("[kbd] failed to create keypress\n", PRINT_FLAG_BOTH);
+        break;
+      }
+
+      keypress_t *kp = (keypress_t *)result_unwrap(rkp);
+
+      keypress_debug(kp);
+
+      free_page(kp);
+    };
+
+    tail++;
+    __atomic_store_n(&kbd->pending_tail, tail, __ATOMIC_RELEASE);
+  }
+}
+
 void virtio_keyboard_handle_irq(virtio_keyboard_t *kbd) {
   if (!kbd || !kbd->vdev.is_initialized)
     return;
 
   virtio_ack_irq(&kbd->vdev);
 
+  g_bool queued = false;
   while (kbd->q_events.last_used_idx != kbd->q_events.used->idx) {
     uint16_t pos = kbd->q_events.last_used_idx % kbd->q_events.size;
     uint16_t id = kbd->q_events.used->ring[pos].id;
@@ -104,63 +179,19 @@ void virtio_keyboard_handle_irq(virtio_keyboard_t *kbd) {
     // printf("[kbd] type=%{type: str} code=%{type: hex} value=%{type: hex}\n",
     //        PRINT_FLAG_BOTH, ev_type_str(ev->type), ev->code, ev->value);
 
-    // check if it's a key event
+    // only key events are kept, copied out before the buffer is reposted
     if (ev->type == EV_KEY &&
         (ev->value == KEY_PRESSED || ev->value == KEY_RELEASED)) {
-      // const char *kc = virtio_keycode_to_string(ev->code);
-
-      switch (ev->code) {
-      case KEY_CAPSLOCK:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_CAPSLOCK,
-                              ev->value == KEY_PRESSED);
-        break;
-      case KEY_LEFTALT:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_LALT,
-                              ev->value == KEY_PRESSED);
-        break;
-      case KEY_RIGHTALT:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_RALT,
-                              ev->value == KEY_PRESSED);
-        break;
-      case KEY_LEFTCTRL:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_LCTRL,
-                              ev->value == KEY_PRESSED);
-        break;
-      case KEY_RIGHTCTRL:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_RCTRL,
-                              ev->value == KEY_PRESSED);
-        break;
-      case KEY_LEFTSHIFT:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_LSHIFT,
-                              ev->value == KEY_PRESSED);
-        break;
-      case KEY_RIGHTSHIFT:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_RSHIFT,
-                              ev->value == KEY_PRESSED);
-        break;
-      case KEY_LEFTMETA:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_LMETA,
-                              ev->value == KEY_PRESSED);
-        break;
-      case KEY_RIGHTMETA:
-        KEYPRESS_MODIFIER_SET(kbd->modifiers, KEYPRESS_MODIFIER_RMETA,
-                              ev->value == KEY_PRESSED);
-        break;
-
-      default:
-        result_t rkp = make_keypress(ev->code, kbd->modifiers, ev->value);
-
-        if (!result_is_ok(rkp)) {
-          printf("[kbd] failed to create keypress\n", PRINT_FLAG_BOTH);
-          return;
-        }
-
-        keypress_t *kp = (keypress_t *)result_unwrap(rkp);
-
-        keypress_debug(kp);
-
-        free_page(kp);
-      };
+      uint32_t head = kbd->pending_head;
+      uint32_t tail = __atomic_load_n(&kbd->pending_tail, __ATOMIC_ACQUIRE);
+
+      if (head - tail < VIRTIO_KEYBOARD_PENDING_NUM) {
+        kbd->pending[head % VIRTIO_KEYBOARD_PENDING_NUM] = *ev;
+        __atomic_store_n(&kbd->pending_head, head + 1, __ATOMIC_RELEASE);
+        queued = true;
+      } else {
+        kbd->dropped++;
+      }
     }
 
     kbd->q_events.avail->ring[kbd->q_events.avail->idx % kbd->q_events.size] =
@@ -171,4 +202,7 @@ void virtio_keyboard_handle_irq(virtio_keyboard_t *kbd) {
 
   __sync_synchronize();
   virtio_mmio_write(&kbd->vdev, VIRTIO_MMIO_QUEUE_NOTIFY, 0);
+
+  if (queued)
+    queue_work(&kbd->work);
 }
@@ -2,8 +2,11 @@
 
 #include "virtio_common.h"
 #include "virtio.h"
+#include <lib/deferred.h>
 
 #define VIRTIO_KEYBOARD_EVENT_NUM 16
+/* events the IRQ handler can hold for the bottom half, a power of two */
+#define VIRTIO_KEYBOARD_PENDING_NUM 64
 
 /** single‑byte DRIVER_OK packet for ctrl queue */
 struct virtio_keyboard_status_pkt {
@@ -27,6 +30,14 @@ typedef struct {
 
   /* Current keyboard modifier state */
   uint16_t modifiers;
+
+  /* Key events copied off the used ring by the IRQ handler and turned into
+     keypresses by `work`. Single producer (IRQ), single consumer (work). */
+  struct virtio_input_event pending[VIRTIO_KEYBOARD_PENDING_NUM];
+  uint32_t pending_head; /* next slot the IRQ handler fills */
+  uint32_t pending_tail; /* next slot the bottom half reads */
+  uint64_t dropped;      /* events lost to a full `pending` */
+  work_t work;
 } virtio_keyboard_t;
 
 RESULT_TYPE(virtio_keyboard_t *) make_virtio_keyboard(uint64_t base, uint32_t irq);
@@ -5,6 +5,8 @@
 #include <lib/panic.h>
 #include <lib/print.h>
 
+static void virtio_mouse_motion(void *arg);
+
 /* -------------------------------------------------------------------------- */
 /*  Constructor / initialisation                                              */
 /* -------------------------------------------------------------------------- */
@@ -23,6 +25,7 @@ make_virtio_mouse(uint64_t base, uint32_t irq) {
 
   m->rel_x = m->rel_y = m->wheel = 0;
   m->buttons = 0;
+  tasklet_init(&m->motion, virtio_mouse_motion, m);
   return RESULT_SUCCESS(m);
 }
 
@@ -92,6 +95,17 @@ static const char *btn_code_str(uint16_t c) {
   }
 }
 
+/* bottom half: the cursor redraw is too slow for the IRQ handler */
+static void virtio_mouse_motion(void *arg) {
+  virtio_mouse_t *m = arg;
+
+  int32_t dx = __atomic_exchange_n(&m->rel_x, 0, __ATOMIC_RELAXED);
+  int32_t dy = __atomic_exchange_n(&m->rel_y, 0, __ATOMIC_RELAXED);
+
+  if (shared_cursor_initialized && (dx != 0 || dy != 0))
+    cursor_move(shared_cursor, dx, dy);
+}
+
 void virtio_mouse_handle_irq(virtio_mouse_t *m) {
   if (!m || !m->vdev.is_initialized)
     return;
@@ -106,20 +120,19 @@ void virtio_mouse_handle_irq(virtio_mouse_t *m) {
 
     switch (ev->type) {
     case EV_REL:
+      // the motion tasklet takes these with interrupts on
       if (ev->code == REL_X)
-        m->rel_x += (int32_t)ev->value;
+        __atomic_fetch_add(&m->rel_x, (int32_t)ev->value, __ATOMIC_RELAXED);
       else if (ev->code == REL_Y)
-        m->rel_y += (int32_t)ev->value;
+        __atomic_fetch_add(&m->rel_y, (int32_t)ev->value, __ATOMIC_RELAXED);
       else if (ev->code == REL_WHEEL)
         m->wheel += (int32_t)ev->value;
 
       // printf("[mouse] %{type: str} %{type: int}\n", PRINT_FLAG_BOTH,
       //        rel_code_str(ev->code), (int)ev->value);
 
-      if (shared_cursor_initialized && (m->rel_x != 0 || m->rel_y != 0)) {
-        cursor_move(shared_cursor, m->rel_x, m->rel_y);
-        m->rel_x = m->rel_y = 0; /* consumed */
-      }
+      if (m->rel_x != 0 || m->rel_y != 0)
+        tasklet_schedule(&m->motion);
 
       break;
 
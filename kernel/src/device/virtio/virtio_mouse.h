@@ -1,6 +1,7 @@
 #pragma once
 #include "virtio_common.h"
 #include "virtio.h"
+#include <lib/deferred.h>
 
 #define VIRTIO_MOUSE_EVENT_NUM  16   /* descriptors we keep posted          */
 
@@ -37,6 +38,9 @@ typedef struct {
     int32_t rel_y;
     int32_t wheel;
     uint8_t buttons;   /* bit0=L, bit1=R, bit2=M            */
+
+    /* moves the cursor by rel_x/rel_y outside the IRQ handler */
+    tasklet_t motion;
 } virtio_mouse_t;
 
 RESULT_TYPE(virtio_mouse_t *) make_virtio_mouse(uint64_t base, uint32_t irq);
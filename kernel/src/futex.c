@@ -0,0 +1,72 @@
+#include "futex.h"
+#include "lib/cpu.h"
+#include "lib/timer.h"
+#include "lib/wait_queue.h"
+#include "limine_requests.h"
+#include "proc.h"
+#include <page_table.h>
+
+/* the kernel address of the word at `uaddr`, NULL if not user readable */
+static volatile uint32_t *futex_key(proc_t *p, uint64_t uaddr) {
+  uint64_t pa;
+
+  if (uaddr & (sizeof(uint32_t) - 1))
+    return NULL;
+  // not the trapframe or trampoline: waiting on them would leak their contents
+  if (!get_user_physical_address(p->pagetable, uaddr, PTE_V | PTE_U | PTE_R,
+                                 &pa))
+    return NULL;
+
+  return (volatile uint32_t *)(pa + hhdm_offset);
+}
+
+RESULT_TYPE(void)
+futex_wait(proc_t *p, uint64_t uaddr, uint32_t val, uint64_t timeout_us) {
+  // the sleeper must be the caller, an io_ring poller cannot block for it
+  if (p != current_proc())
+    return RESULT_FAILURE(RESULT_INVALID);
+
+  volatile uint32_t *key = futex_key(p, uaddr);
+  if (!key)
+    return RESULT_FAILURE(RESULT_INVALID);
+
+  // a timeout the `time` CSR never reaches is the same as none, and must not
+  // wrap around into a deadline that already passed
+  uint64_t deadline = 0;
+  uint64_t now = get_csrr_time();
+  if (timeout_us > (UINT64_MAX - now) / TIMER_TICKS_PER_US)
+    timeout_us = 0;
+  if (timeout_us)
+    deadline = now + timer_us_to_ticks(timeout_us);
+
+  // a waker must take this lock to find us, so the value cannot change
+  // unseen between the check and sleeping
+  wait_bucket_t *b = wait_bucket((void *)key);
+  acquire(&b->lock);
+
+  if (__atomic_load_n(key, __ATOMIC_ACQUIRE) != val) {
+    release(&b->lock);
+    return RESULT_FAILURE(RESULT_BUSY);
+  }
+  if (killed(p)) {
+    release(&b->lock);
+    return RESULT_SUCCESS(0);
+  }
+
+  result_t r = RESULT_SUCCESS(0);
+  if (timeout_us)
+    r = sleep_timeout((void *)key, &b->lock, deadline);
+  else
+    sleep((void *)key, &b->lock);
+
+  release(&b->lock);
+  return r;
+}
+
+RESULT_TYPE(uint64_t) futex_wake(proc_t *p, uint64_t uaddr, uint64_t n) {
+  volatile uint32_t *key = futex_key(p, uaddr);
+  if (!key)
+    return RESULT_FAILURE(RESULT_INVALID);
+
+  return RESULT_SUCCESS(wakeup_n((void *)key, n));
+}
@@ -0,0 +1,33 @@
+#pragma once
+/*
+ * Futexes: blocking on a user memory word.
+ *
+ * A proc that finds a lock or queue word busy calls SYS_FUTEX_WAIT with the
+ * value it saw. The kernel rechecks the word under the wait bucket lock and
+ * sleeps only if it still holds that value, so a wake between the user-space
+ * check and the call is never lost. SYS_FUTEX_WAKE wakes up to `n` waiters,
+ * oldest first. Uncontended lock and unlock never enter the kernel.
+ *
+ * Waiters are keyed on the word's physical address, so procs sharing a page
+ * meet on the same futex whatever address they map it at. The key is the
+ * word's kernel (HHDM) address, which doubles as the sleep() channel.
+ */
+
+#include <lib/result.h>
+#include <lib/types.h>
+
+typedef struct proc proc_t;
+
+/*
+ * Sleeps while the 32-bit word at user address `uaddr` of `p` equals `val`,
+ * at most `timeout_us` microseconds (0, or one too large for the `time` CSR
+ * to reach, waits forever). Fails with RESULT_BUSY if the word differs,
+ * RESULT_TIMEOUT when the timeout ran out and RESULT_INVALID for an
+ * unaligned address or one that is not readable user memory. May return
+ * without a wake, e.g. when killed; callers recheck the word.
+ */
+RESULT_TYPE(void)
+futex_wait(proc_t *p, uint64_t uaddr, uint32_t val, uint64_t timeout_us);
+
+/* Wakes at most `n` procs waiting on `uaddr`. Returns how many it woke. */
+RESULT_TYPE(uint64_t) futex_wake(proc_t *p, uint64_t uaddr, uint64_t n);
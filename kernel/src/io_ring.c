@@ -0,0 +1,203 @@
+#include "io_ring.h"
+#include "lib/memory.h"
+#include "lib/timer.h"
+#include "proc.h"
+#include "syscall.h"
+#include <lib/panic.h>
+#include <page_table.h>
+#include <physical_alloc.h>
+
+_Static_assert(sizeof(io_ring_shared_t) <= PAGE_SIZE,
+               "io_ring header and CQ must fit a page");
+_Static_assert(IO_RING_SQ_ENTRIES * sizeof(io_sqe_t) <= PAGE_SIZE,
+               "io_ring SQ must fit a page");
+
+static g_bool sq_pending(io_ring_t *r) {
+  return __atomic_load_n(&r->shared->sq_tail, __ATOMIC_ACQUIRE) != r->sq_head;
+}
+
+/* syscalls that make no sense from a ring */
+static g_bool opcode_allowed(uint64_t opcode) {
+  return opcode != SYS_EXIT && opcode != SYS_IO_RING_SETUP &&
+         opcode != SYS_IO_RING_ENTER;
+}
+
+/* consumes up to `max` SQEs, posting one CQE each */
+static uint32_t io_ring_submit(io_ring_t *r, uint64_t max) {
+  io_ring_shared_t *sh = r->shared;
+  uint32_t tail = __atomic_load_n(&sh->sq_tail, __ATOMIC_ACQUIRE);
+  uint32_t n = 0;
+
+  // a tail more than a ring ahead is garbage, ignore the excess
+  if ((uint32_t)(tail - r->sq_head) > IO_RING_SQ_ENTRIES)
+    tail = r->sq_head + IO_RING_SQ_ENTRIES;
+
+  while (r->sq_head != tail && n < max) {
+    uint32_t cq_head = __atomic_load_n(&sh->cq_head, __ATOMIC_ACQUIRE);
+    if ((uint32_t)(r->cq_tail - cq_head) >= IO_RING_CQ_ENTRIES)
+      break;
+
+    // the proc may rewrite the slot meanwhile, work on a copy
+    io_sqe_t sqe = r->sqes[r->sq_head % IO_RING_SQ_ENTRIES];
+
+    int64_t res;
+    if (opcode_allowed(sqe.opcode)) {
+      res = syscall_invoke(r->owner, sqe.opcode, sqe.args);
+    } else {
+      res = -EINVAL;
+      sh->invalid++;
+    }
+
+    io_cqe_t *cqe = &sh->cqes[r->cq_tail % IO_RING_CQ_ENTRIES];
+    cqe->user_data = sqe.user_data;
+    cqe->res = res;
+
+    r->cq_tail++;
+    r->sq_head++;
+    n++;
+
+    // publish each completion, a batch may take a while
+    __atomic_store_n(&sh->cq_tail, r->cq_tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&sh->sq_head, r->sq_head, __ATOMIC_RELEASE);
+  }
+
+  if (n) {
+    r->submitted += n;
+    r->batches++;
+  }
+
+  return n;
+}
+
+static void io_ring_poll(void *arg) {
+  io_ring_t *r = arg;
+  uint64_t idle_ticks = timer_us_to_ticks(IO_RING_SQPOLL_IDLE_US);
+  uint64_t last_work = get_csrr_time();
+
+  for (;;) {
+    if (io_ring_submit(r, UINT64_MAX))
+      last_work = get_csrr_time();
+
+    acquire(&r->lock);
+    if (r->dead)
+      break;
+
+    if (sq_pending(r) || get_csrr_time() - last_work < idle_ticks) {
+      release(&r->lock);
+      yield();
+      continue;
+    }
+
+    // ask for a wakeup, then look once more: a submission made before the
+    // flag was visible would otherwise go unnoticed
+    __atomic_fetch_or(&r->shared->flags, IO_RING_NEED_WAKEUP,
+                      __ATOMIC_SEQ_CST);
+    while (!r->dead && !sq_pending(r))
+      sleep(r, &r->lock);
+    __atomic_fetch_and(&r->shared->flags, ~IO_RING_NEED_WAKEUP,
+                       __ATOMIC_RELAXED);
+    release(&r->lock);
+
+    last_work = get_csrr_time();
+  }
+
+  r->poller = NULL;
+  wakeup(&r->poller);
+  release(&r->lock);
+}
+
+static void io_ring_free(io_ring_t *r) {
+  if (r->shared)
+    free_page(r->shared);
+  if (r->sqes)
+    free_page(r->sqes);
+  free_page(r);
+}
+
+RESULT_TYPE(uint64_t) io_ring_setup(proc_t *p, uint64_t flags) {
+  if (p->io_ring)
+    return RESULT_FAILURE(RESULT_BUSY);
+  if (flags & ~(uint64_t)IO_RING_SQPOLL)
+    return RESULT_FAILURE(RESULT_INVALID);
+
+  io_ring_t *r = alloc_page();
+  if (!r)
+    return RESULT_FAILURE(RESULT_NOMEM);
+  memset(r, 0, sizeof(io_ring_t));
+  initlock(&r->lock, "io_ring");
+  r->owner = p;
+
+  r->shared = alloc_page();
+  r->sqes = alloc_page();
+  if (!r->shared || !r->sqes) {
+    io_ring_free(r);
+    return RESULT_FAILURE(RESULT_NOMEM);
+  }
+  memset(r->shared, 0, PAGE_SIZE);
+  memset(r->sqes, 0, PAGE_SIZE);
+  r->shared->sq_entries = IO_RING_SQ_ENTRIES;
+  r->shared->cq_entries = IO_RING_CQ_ENTRIES;
+
+  uint64_t perm = PTE_R | PTE_W | PTE_U | PTE_V;
+  if (!map_page(p->pagetable, IO_RING_BASE, V2P((uint64_t)r->shared), perm)) {
+    io_ring_free(r);
+    return RESULT_FAILURE(RESULT_NOMEM);
+  }
+  if (!map_page(p->pagetable, IO_RING_BASE + PAGE_SIZE, V2P((uint64_t)r->sqes),
+                perm)) {
+    unmap_page(p->pagetable, IO_RING_BASE);
+    io_ring_free(r);
+    return RESULT_FAILURE(RESULT_NOMEM);
+  }
+
+  p->io_ring = r;
+
+  if (flags & IO_RING_SQPOLL) {
+    kernel_task_opts_t opts = {.priority = p->priority};
+    result_t rt = make_kernel_task_opts(io_ring_poll, r, "sqpoll", &opts);
+    if (!result_is_ok(rt)) {
+      io_ring_destroy(p);
+      return RESULT_FAILURE(RESULT_NOMEM);
+    }
+    acquire(&r->lock);
+    if (!r->dead)
+      r->poller = (proc_t *)result_unwrap(rt);
+    release(&r->lock);
+  }
+
+  return RESULT_SUCCESS(IO_RING_BASE);
+}
+
+RESULT_TYPE(uint64_t) io_ring_enter(proc_t *p, uint64_t to_submit) {
+  io_ring_t *r = p->io_ring;
+  if (!r)
+    return RESULT_FAILURE(RESULT_INVALID);
+
+  if (r->poller) {
+    acquire(&r->lock);
+    wakeup(r);
+    release(&r->lock);
+    return RESULT_SUCCESS(0);
+  }
+
+  return RESULT_SUCCESS(io_ring_submit(r, to_submit));
+}
+
+void io_ring_destroy(proc_t *p) {
+  io_ring_t *r = p->io_ring;
+  if (!r)
+    return;
+
+  acquire(&r->lock);
+  r->dead = true;
+  wakeup(r);
+  while (r->poller)
+    sleep(&r->poller, &r->lock);
+  release(&r->lock);
+
+  unmap_page(p->pagetable, IO_RING_BASE);
+  unmap_page(p->pagetable, IO_RING_BASE + PAGE_SIZE);
+  p->io_ring = NULL;
+
+  io_ring_free(r);
+}
@@ -0,0 +1,98 @@
+#pragma once
+/*
+ * Submission/completion rings for batched syscalls.
+ *
+ * SYS_IO_RING_SETUP maps IO_RING_PAGES shared pages at IO_RING_BASE. The
+ * first holds an io_ring_shared_t header followed by the completion queue,
+ * the second the submission queue. A proc fills SQEs, each naming a syscall
+ * number and its arguments, advances sq_tail and calls SYS_IO_RING_ENTER once
+ * for the whole batch. Every SQE consumed produces one CQE with the same
+ * user_data and the syscall's result; SQEs are consumed in order.
+ *
+ * The producer of a queue owns its tail and the consumer its head. Each side
+ * publishes its index with a release store and reads the other's with an
+ * acquire load. The kernel keeps its own copies of sq_head and cq_tail, so a
+ * proc scribbling over them only confuses itself.
+ *
+ * With IO_RING_SQPOLL a kernel task consumes the SQ instead and ENTER
+ * submits nothing. The task keeps polling while there is work and sleeps
+ * after IO_RING_SQPOLL_IDLE_US without any, setting IO_RING_NEED_WAKEUP in
+ * `flags`; the proc then calls ENTER after queueing to wake it.
+ */
+
+#include <lib/result.h>
+#include <lib/spinlock.h>
+#include <lib/types.h>
+#include <mem_layout.h>
+
+typedef struct proc proc_t;
+
+/* SYS_IO_RING_SETUP flags */
+#define IO_RING_SQPOLL (1 << 0)
+
+/* io_ring_shared_t.flags, set by the kernel */
+#define IO_RING_NEED_WAKEUP (1 << 0)
+
+#define IO_RING_SQ_ENTRIES 64  /* one page of SQEs */
+#define IO_RING_CQ_ENTRIES 128 /* fit after the header in the first page */
+
+#define IO_RING_SQPOLL_IDLE_US 2000
+
+/* one syscall to run, written by the proc */
+typedef struct io_sqe {
+  uint64_t opcode;    /* SYS_* number */
+  uint64_t user_data; /* copied to the CQE untouched */
+  uint64_t args[6];   /* a0-a5 */
+} io_sqe_t;
+
+/* result of one SQE, written by the kernel */
+typedef struct io_cqe {
+  uint64_t user_data;
+  int64_t res; /* what a0 would hold after the ecall */
+} io_cqe_t;
+
+typedef struct io_ring_shared {
+  uint32_t sq_head; /* kernel: next SQE it will consume */
+  uint32_t sq_tail; /* proc: one past the last SQE queued */
+  uint32_t cq_head; /* proc: next CQE it will read */
+  uint32_t cq_tail; /* kernel: one past the last CQE posted */
+  uint32_t sq_entries;
+  uint32_t cq_entries;
+  uint32_t flags;   /* IO_RING_NEED_WAKEUP */
+  uint32_t invalid; /* SQEs refused, e.g. SYS_EXIT */
+  uint64_t reserved[4];
+  io_cqe_t cqes[IO_RING_CQ_ENTRIES];
+} io_ring_shared_t;
+
+/* kernel side of a ring, one per proc */
+typedef struct io_ring {
+  struct spinlock lock;      /* dead, poller */
+  io_ring_shared_t *shared;  /* first shared page */
+  io_sqe_t *sqes;            /* second shared page */
+  uint32_t sq_head;          /* kernel copies of the indices it owns */
+  uint32_t cq_tail;
+  proc_t *owner;             /* the proc SQEs run for */
+  proc_t *poller;            /* IO_RING_SQPOLL task, NULL if none */
+  g_bool dead;               /* owner exiting, the poller should stop */
+  uint64_t submitted;        /* SQEs consumed */
+  uint64_t batches;          /* non-empty passes over the SQ */
+} io_ring_t;
+
+/*
+ * Creates p's ring and maps it at IO_RING_BASE. Returns that address, or
+ * fails with RESULT_BUSY if `p` already has a ring.
+ */
+RESULT_TYPE(uint64_t) io_ring_setup(proc_t *p, uint64_t flags);
+
+/*
+ * Consumes up to `to_submit` queued SQEs of p's ring and returns how many.
+ * Stops early when the CQ is full. With IO_RING_SQPOLL only wakes the poller
+ * and returns 0.
+ */
+RESULT_TYPE(uint64_t) io_ring_enter(proc_t *p, uint64_t to_submit);
+
+/*
+ * Stops p's poller, unmaps and frees the ring. Called by exit() while `p` is
+ * still alive, since the poller runs syscalls on its behalf.
+ */
+void io_ring_destroy(proc_t *p);
@@ -0,0 +1,103 @@
+#include "irq.h"
+#include "device/plic.h"
+#include "device/shared.h"
+#include "lib/panic.h"
+#include "lib/print.h"
+#include "lib/spinlock.h"
+#include "lib/timer.h"
+
+typedef struct irq_entry {
+  irq_handler_t handler;
+  void *ctx;
+  uint64_t count;  /* times claimed */
+  uint64_t cycles; /* claim to complete, summed */
+} irq_entry_t;
+
+static irq_entry_t irq_table[IRQ_MAX];
+static uint64_t irq_unhandled; /* claims of a source without a handler */
+static struct spinlock irq_lock = {.locked = false, .name = "irq"};
+
+RESULT_TYPE(void)
+irq_register(uint32_t irq, irq_handler_t handler, void *ctx, uint32_t flags) {
+  if (irq == 0 || irq >= IRQ_MAX || !handler)
+    return RESULT_FAILURE(RESULT_INVALID);
+  if (!shared_plic_initialized)
+    return RESULT_FAILURE(RESULT_ERROR);
+
+  uint32_t priority = flags & IRQ_PRIORITY_MASK;
+  if (priority == 0)
+    priority = 1;
+
+  acquire(&irq_lock);
+  irq_entry_t *e = &irq_table[irq];
+  if (e->handler) {
+    release(&irq_lock);
+    return RESULT_FAILURE(RESULT_BUSY);
+  }
+
+  e->ctx = ctx;
+  e->count = 0;
+  e->cycles = 0;
+  // publish ctx before the handler, dispatch reads them without the lock
+  __atomic_store_n(&e->handler, handler, __ATOMIC_RELEASE);
+
+  plic_set_priority(shared_plic, irq, priority);
+  plic_enable_interrupt(shared_plic, IRQ_HART, PLIC_CONTEXT_SUPERVISOR,
+                        irq);
+  release(&irq_lock);
+
+  return RESULT_SUCCESS(0);
+}
+
+void irq_unregister(uint32_t irq) {
+  if (irq == 0 || irq >= IRQ_MAX)
+    return;
+
+  acquire(&irq_lock);
+  if (shared_plic_initialized) {
+    plic_disable_interrupt(shared_plic, IRQ_HART, PLIC_CONTEXT_SUPERVISOR,
+                           irq);
+    plic_set_priority(shared_plic, irq, 0);
+  }
+  __atomic_store_n(&irq_table[irq].handler, NULL, __ATOMIC_RELEASE);
+  release(&irq_lock);
+}
+
+void irq_dispatch(uint32_t irq) {
+  uint64_t start = get_time_in_cycles();
+
+  irq_entry_t *e = irq < IRQ_MAX ? &irq_table[irq] : NULL;
+  irq_handler_t handler =
+      e ? __atomic_load_n(&e->handler, __ATOMIC_ACQUIRE) : NULL;
+
+  if (handler)
+    handler(e->ctx);
+  else
+    __atomic_fetch_add(&irq_unhandled, 1, __ATOMIC_RELAXED);
+
+  if (!shared_plic_complete(IRQ_HART, PLIC_CONTEXT_SUPERVISOR, irq))
+    panic_msg("Failed to complete PLIC interrupt");
+
+  // the PLIC hands a source to one hart until it is completed, but the
+  // source can be claimed again elsewhere before these land
+  if (handler) {
+    __atomic_fetch_add(&e->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&e->cycles, get_time_in_cycles() - start,
+                       __ATOMIC_RELAXED);
+  }
+}
+
+void irq_print_stats(void) {
+  for (uint32_t i = 1; i < IRQ_MAX; i++) {
+    irq_entry_t *e = &irq_table[i];
+    if (!e->count)
+      continue;
+
+    printf("irq %{type: int}: %{type: int} interrupts, %{type: int} cycles "
+           "each\n",
+           PRINT_FLAG_BOTH, i, e->count, e->cycles / e->count);
+  }
+
+  printf("irq: %{type: int} interrupts without a handler\n", PRINT_FLAG_BOTH,
+         irq_unhandled);
+}
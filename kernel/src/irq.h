@@ -0,0 +1,46 @@
+#pragma once
+/*
+ * External (PLIC) interrupt dispatch.
+ *
+ * A driver registers a handler for its PLIC source with irq_register(),
+ * which also sets the source's priority and enables it for the supervisor
+ * context. handle_external_interrupt() claims the pending source, calls its
+ * handler and completes it.
+ *
+ * Only hart 0's supervisor context is enabled and has its threshold set, so
+ * every external interrupt is taken, claimed and completed on hart 0.
+ */
+
+#include <lib/result.h>
+#include <lib/types.h>
+
+/* highest PLIC source number + 1 that can be registered */
+#ifndef IRQ_MAX
+#define IRQ_MAX 64
+#endif
+
+/* the PLIC hart whose supervisor context sources are routed to */
+#define IRQ_HART 0
+
+/* irq_register() flags: the PLIC priority (1-7) in the low bits, 0 means 1 */
+#define IRQ_PRIORITY(n) ((uint32_t)(n) & IRQ_PRIORITY_MASK)
+#define IRQ_PRIORITY_MASK 0x7
+
+/* Called with interrupts off, between claim and complete. */
+typedef void (*irq_handler_t)(void *ctx);
+
+/*
+ * Sets `handler` for PLIC source `irq` and enables it. Fails with
+ * RESULT_BUSY if the source already has a handler.
+ */
+RESULT_TYPE(void)
+irq_register(uint32_t irq, irq_handler_t handler, void *ctx, uint32_t flags);
+
+/* Disables `irq` and removes its handler. */
+void irq_unregister(uint32_t irq);
+
+/* Handles one claimed source, see handle_external_interrupt(). */
+void irq_dispatch(uint32_t irq);
+
+/* Prints how often each source fired and its average claim-to-complete cost. */
+void irq_print_stats(void);
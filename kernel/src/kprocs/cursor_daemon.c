@@ -1,12 +1,9 @@
 #include "cursor_daemon.h"
 #include <device/shared.h>
-#include <lib/time.h>
 #include <proc.h>
 
 void cursor_daemon(void *arg) {
   (void)arg;
-  const uint64_t frame_us =
-      1000000 / 10; /* 10 Hz - cursor doesn't need constant redraw */
 
   while (1) {
     // Cursor is redrawn automatically when it moves via cursor_move()
@@ -14,7 +11,6 @@ void cursor_daemon(void *arg) {
     if (shared_cursor_initialized)
       cursor_redraw(shared_cursor);
 
-    sleep_us(frame_us);
-    yield(); /* let others run */
+    wait_next_period();
   }
 }
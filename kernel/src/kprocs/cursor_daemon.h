@@ -1,3 +1,8 @@
 #pragma once
 
+/* 10 Hz - cursor doesn't need constant redraw */
+#define CURSOR_DAEMON_PERIOD_US (1000000 / 10)
+#define CURSOR_DAEMON_BUDGET_US 2000
+
+/* Periodic task, see make_kernel_task_opts() */
 void cursor_daemon(void *arg);
@@ -1,3 +1,7 @@
 #pragma once
 
+#define WALLPAPER_DAEMON_PERIOD_US (1000000 / 30) /* 30 Hz */
+#define WALLPAPER_DAEMON_BUDGET_US 10000
+
+/* Periodic task, see make_kernel_task_opts() */
 void wallpaper_daemon(void *arg);
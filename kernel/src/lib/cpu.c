@@ -1,4 +1,5 @@
 #include "cpu.h"
+#include "lib/intr_trace.h"
 #include "platform/registers.h"
 
 struct cpu cpus[NCPU];
@@ -13,13 +14,48 @@ proc_t *current_proc(void) {
   return c->proc;
 }
 
-void intr_push_off() {
+void intr_push_off() { intr_push_off_at(__builtin_return_address(0)); }
+
+void intr_push_off_at(void *site) {
   int old = PS_get_interrupt_enabled();
 
   PS_disable_interrupts();
-  if (current_cpu()->noff == 0)
-    current_cpu()->intena = old;
-  current_cpu()->noff += 1;
+  struct cpu *c = current_cpu();
+  if (c->noff == 0) {
+    c->intena = old;
+#ifdef INTR_TRACE
+    if (old)
+      intr_trace_begin(c, site);
+#endif
+  }
+  c->noff += 1;
+  (void)site;
+}
+
+g_bool preemptible(void) {
+  struct cpu *c = current_cpu();
+  return c->noff == 0 && c->preempt_count == 0;
+}
+
+void preempt_disable(void) {
+  // interrupts off so the count lands on the hart we are running on
+  intr_push_off();
+  current_cpu()->preempt_count++;
+  intr_pop_off();
+}
+
+void preempt_enable(void) {
+  intr_push_off();
+  struct cpu *c = current_cpu();
+  if (c->preempt_count < 1)
+    panic("preempt_enable");
+  c->preempt_count--;
+  g_bool resched = c->preempt_count == 0 && c->need_resched && c->proc;
+  intr_pop_off();
+
+  // the timeslice ran out while preemption was off
+  if (resched && preemptible() && PS_get_interrupt_enabled())
+    yield();
 }
 
 void intr_pop_off() {
@@ -29,6 +65,10 @@ void intr_pop_off() {
   if (c->noff < 1)
     panic("pop_off");
   c->noff -= 1;
-  if (c->noff == 0 && c->intena)
+  if (c->noff == 0 && c->intena) {
+#ifdef INTR_TRACE
+    intr_trace_end(c);
+#endif
     PS_enable_interrupts();
+  }
 }
@@ -4,6 +4,8 @@
 #include "platform/interrupts.h"
 #include <lib/context.h>
 #include "proc.h"
+#include "sched.h"
+#include "lib/timer_queue.h"
 #include <lib/macros.h>
 #include <lib/types.h>
 
@@ -15,14 +17,45 @@ struct cpu {
   context_t context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int preempt_count;          // Depth of preempt_disable() nesting.
+  g_bool online;              // Has this hart entered scheduler()?
+  runqueue_t rq;              // RUNNABLE procs assigned to this hart.
+  timer_queue_t timers;       // Pending kernel timers of this hart.
+  uint64_t slice_end;         // End of the running proc's timeslice.
+  uint64_t exec_start;        // When the running proc was last charged.
+  g_bool need_resched;        // Timeslice expired, yield when possible.
+  uint64_t preemptions;       // Procs preempted in kernel mode.
+  proc_t *fpu_owner;          // Whose FP/vector state the registers hold.
+  proc_t *handoff_prev;       // Proc that yield_to() switched away from.
+  uint64_t handoffs;          // Directed switches done by yield_to().
+  uint64_t irq_entries;       // Kernel-mode interrupts taken.
+  uint64_t irq_entry_cycles;  // Cycles from their vector to the C handler.
 };
 
 extern struct cpu cpus[NCPU];
 
 typedef struct cpu cpu_t;
 
+G_INLINE int cpu_id(struct cpu *c) { return (int)(c - cpus); }
+
 struct cpu *current_cpu(void);
 proc_t *current_proc(void);
 
 void intr_push_off();
 void intr_pop_off();
+
+/* intr_push_off() on behalf of `site`, for the INTR_TRACE tracer */
+void intr_push_off_at(void *site);
+
+/*
+ * Kernel preemption.
+ *
+ * A proc running kernel code may be switched out on return from an
+ * interrupt once its timeslice expired, unless preemption is disabled:
+ * while interrupts are pushed off (which includes holding any spinlock) or
+ * between preempt_disable() and preempt_enable(). A section that must stay
+ * on one hart without turning interrupts off uses the latter.
+ */
+void preempt_disable(void);
+void preempt_enable(void);
+g_bool preemptible(void);
@@ -0,0 +1,141 @@
+#include "deferred.h"
+#include "lib/cpu.h"
+#include "lib/print.h"
+#include "lib/timer.h"
+#include "proc.h"
+#include <platform/interrupts.h>
+
+typedef struct tasklet_queue {
+  tasklet_t *head;
+  tasklet_t *tail;
+  g_bool running;    /* a nested interrupt leaves the list to the outer run */
+  uint64_t runs;
+} tasklet_queue_t;
+
+static tasklet_queue_t tasklet_queues[NCPU];
+
+static struct spinlock work_lock = {.locked = false, .name = "kworker"};
+static list_node_t work_queue = {&work_queue, &work_queue};
+static uint64_t work_runs;
+static uint64_t work_delay; /* queue to start, `time` CSR ticks, summed */
+
+void tasklet_init(tasklet_t *t, void (*fn)(void *), void *arg) {
+  t->fn = fn;
+  t->arg = arg;
+  t->next = NULL;
+  t->scheduled = false;
+}
+
+g_bool tasklet_schedule(tasklet_t *t) {
+  if (__atomic_exchange_n(&t->scheduled, true, __ATOMIC_ACQ_REL))
+    return false;
+
+  intr_push_off();
+  tasklet_queue_t *q = &tasklet_queues[cpu_id(current_cpu())];
+  t->next = NULL;
+  if (q->tail)
+    q->tail->next = t;
+  else
+    q->head = t;
+  q->tail = t;
+  intr_pop_off();
+
+  return true;
+}
+
+void tasklet_run_pending(void) {
+  tasklet_queue_t *q = &tasklet_queues[cpu_id(current_cpu())];
+  if (!q->head || q->running)
+    return;
+
+  // stay on this hart: a nested timer interrupt must not switch us out
+  // while the queue is marked running
+  preempt_disable();
+  q->running = true;
+
+  while (q->head) {
+    tasklet_t *t = q->head;
+    q->head = t->next;
+    if (!q->head)
+      q->tail = NULL;
+    t->next = NULL;
+
+    // cleared first so the tasklet can be scheduled again while it runs
+    __atomic_store_n(&t->scheduled, false, __ATOMIC_RELEASE);
+    q->runs++;
+
+    PS_enable_interrupts();
+    t->fn(t->arg);
+    PS_disable_interrupts();
+  }
+
+  q->running = false;
+  preempt_enable(); // interrupts are off, so this never yields
+}
+
+void work_init(work_t *w, void (*fn)(void *), void *arg) {
+  w->fn = fn;
+  w->arg = arg;
+  w->node.prev = w->node.next = NULL;
+  w->pending = false;
+  w->queued_at = 0;
+}
+
+g_bool queue_work(work_t *w) {
+  acquire(&work_lock);
+  if (w->pending) {
+    release(&work_lock);
+    return false;
+  }
+
+  w->pending = true;
+  w->queued_at = get_csrr_time();
+  list_push_back(&work_queue, &w->node);
+  release(&work_lock);
+
+  wakeup(&work_queue);
+  return true;
+}
+
+static void kworker(void *arg) {
+  (void)arg;
+
+  acquire(&work_lock);
+  for (;;) {
+    while (list_empty(&work_queue))
+      sleep(&work_queue, &work_lock);
+
+    work_t *w = LIST_ENTRY(work_queue.next, work_t, node);
+    list_remove(&w->node);
+    w->pending = false;
+    work_runs++;
+    work_delay += get_csrr_time() - w->queued_at;
+    release(&work_lock);
+
+    w->fn(w->arg);
+
+    acquire(&work_lock);
+  }
+}
+
+void deferred_init(void) {
+  kernel_task_opts_t opts = {
+      .priority = PROC_PRIORITY_HIGH,
+  };
+
+  result_t r = make_kernel_task_opts(kworker, NULL, "kworker", &opts);
+  if (!result_is_ok(r))
+    panic("deferred_init: failed to create kworker");
+}
+
+void deferred_print_stats(void) {
+  for (int i = 0; i < NCPU; i++) {
+    if (tasklet_queues[i].runs)
+      printf("hart %{type: int}: %{type: int} tasklets run\n", PRINT_FLAG_BOTH,
+             i, tasklet_queues[i].runs);
+  }
+
+  if (work_runs)
+    printf("kworker: %{type: int} work items, %{type: int} ticks queued each\n",
+           PRINT_FLAG_BOTH, work_runs, work_delay / work_runs);
+}
@@ -0,0 +1,57 @@
+#pragma once
+/*
+ * Deferred work for interrupt bottom halves.
+ *
+ * An interrupt handler should only acknowledge its device and save what it
+ * needs, then hand the rest to one of:
+ *
+ *   tasklet  - runs on the hart that scheduled it, on the way out of the
+ *              interrupt, with interrupts enabled. It must not sleep.
+ *   work     - runs in the kworker kernel task, so it may take as long as it
+ *              likes and may sleep.
+ *
+ * Scheduling either while it is already pending does nothing, so a burst of
+ * interrupts costs one run. Both may be scheduled again while they run.
+ */
+
+#include <lib/list.h>
+#include <lib/spinlock.h>
+#include <lib/types.h>
+#include <stdint.h>
+
+typedef struct tasklet {
+  void (*fn)(void *arg);
+  void *arg;
+  struct tasklet *next; /* per-hart pending list */
+  g_bool scheduled;
+} tasklet_t;
+
+typedef struct work {
+  void (*fn)(void *arg);
+  void *arg;
+  list_node_t node; /* kworker queue */
+  g_bool pending;
+  uint64_t queued_at; /* `time` CSR when queued */
+} work_t;
+
+void tasklet_init(tasklet_t *t, void (*fn)(void *), void *arg);
+
+/* Queues `t` on this hart. Returns false if it was already pending. */
+g_bool tasklet_schedule(tasklet_t *t);
+
+/*
+ * Runs this hart's pending tasklets. Called with interrupts off at the end of
+ * interrupt handling; turns them on around each tasklet.
+ */
+void tasklet_run_pending(void);
+
+void work_init(work_t *w, void (*fn)(void *), void *arg);
+
+/* Queues `w` for kworker. Returns false if it was already pending. */
+g_bool queue_work(work_t *w);
+
+/* Starts kworker. Work queued before this runs once it starts. */
+void deferred_init(void);
+
+/* Prints tasklet runs per hart and kworker's queueing delay. */
+void deferred_print_stats(void);
@@ -0,0 +1,287 @@
+#include "fpu.h"
+#include "buddy_allocator.h"
+#include "lib/cpu.h"
+#include "lib/usermem.h"
+#include "proc.h"
+#include <lib/memory.h>
+#include <platform/interrupts.h>
+#include <platform/registers.h>
+
+#define CSR_VLENB 0xc22
+
+/* what unit an instruction needs, see insn_unit() */
+#define UNIT_NONE 0
+#define UNIT_FP 1
+#define UNIT_VEC 2
+
+/* fpu.S */
+extern void fpu_save_regs(struct fpu_regs *f);
+extern void fpu_load_regs(struct fpu_regs *f);
+extern void vec_save_regs(struct vec_regs *v);
+extern void vec_load_regs(struct vec_regs *v);
+
+static g_bool has_fpu;
+static g_bool has_vec;
+static uint64_t vlenb;
+
+void fpu_init(void) {
+  uint64_t status = PS_get_status();
+
+  // FS and VS are WARL: they read back as 0 if the unit does not exist
+  PS_set_status(status | SSTATUS_FS_INITIAL | SSTATUS_VS_INITIAL);
+  uint64_t probe = PS_get_status();
+  has_fpu = (probe & SSTATUS_FS) != 0;
+  has_vec = (probe & SSTATUS_VS) != 0;
+
+  if (has_vec)
+    asm volatile("csrr %0, %1" : "=r"(vlenb) : "i"(CSR_VLENB));
+
+  PS_set_status(status & ~(SSTATUS_FS | SSTATUS_VS));
+}
+
+void fpu_state_init(fpu_state_t *s) {
+  memset(&s->regs, 0, sizeof(s->regs));
+  s->vregs = NULL;
+  s->vorder = 0;
+  s->cpu = -1;
+  s->used = false;
+  s->vused = false;
+  s->dirty = false;
+  s->vdirty = false;
+}
+
+void fpu_state_free(fpu_state_t *s) {
+  if (s->vregs)
+    buddy_free_pages(s->vregs, s->vorder);
+  s->vregs = NULL;
+  s->cpu = -1;
+}
+
+static g_bool vec_alloc(fpu_state_t *s) {
+  uint64_t size = sizeof(struct vec_regs) + 32 * vlenb;
+
+  int order = 0;
+  while ((4096UL << order) < size)
+    order++;
+
+  s->vregs = buddy_alloc_pages(order);
+  if (!s->vregs)
+    return false;
+
+  memset(s->vregs, 0, size);
+  s->vorder = order;
+  return true;
+}
+
+/* saves whatever `p` dirtied. Runs on the hart holding p's registers. */
+static void fpu_save(proc_t *p) {
+  uint64_t status = PS_get_status();
+
+  if (p->fpu.dirty) {
+    PS_set_status(status | SSTATUS_FS_CLEAN);
+    fpu_save_regs(&p->fpu.regs);
+    p->fpu.dirty = false;
+  }
+
+  if (p->fpu.vdirty) {
+    PS_set_status(status | SSTATUS_VS_CLEAN);
+    vec_save_regs(p->fpu.vregs);
+    p->fpu.vdirty = false;
+  }
+
+  PS_set_status(status);
+}
+
+/* loads p's registers into this hart */
+static void fpu_load(cpu_t *c, proc_t *p) {
+  uint64_t status = PS_get_status();
+
+  PS_set_status(status | SSTATUS_FS_CLEAN | SSTATUS_VS_CLEAN);
+  if (p->fpu.used)
+    fpu_load_regs(&p->fpu.regs);
+  if (p->fpu.vused)
+    vec_load_regs(p->fpu.vregs);
+  PS_set_status(status);
+
+  c->fpu_owner = p;
+  p->fpu.cpu = cpu_id(c);
+}
+
+static g_bool fpu_loaded(cpu_t *c, proc_t *p) {
+  return c->fpu_owner == p && p->fpu.cpu == cpu_id(c);
+}
+
+g_bool fpu_fork(proc_t *parent, proc_t *child) {
+  intr_push_off();
+  if (fpu_loaded(current_cpu(), parent))
+    fpu_save(parent);
+  intr_pop_off();
+
+  child->fpu.regs = parent->fpu.regs;
+  child->fpu.used = parent->fpu.used;
+
+  if (parent->fpu.vused) {
+    if (!vec_alloc(&child->fpu))
+      return false;
+    memcpy(child->fpu.vregs, parent->fpu.vregs,
+           sizeof(struct vec_regs) + 32 * vlenb);
+    child->fpu.vused = true;
+  }
+
+  return true;
+}
+
+void fpu_user_enter(proc_t *p) {
+  uint64_t status = PS_get_status();
+
+  if ((status & SSTATUS_FS) == SSTATUS_FS_DIRTY)
+    p->fpu.dirty = true;
+  if ((status & SSTATUS_VS) == SSTATUS_VS_DIRTY)
+    p->fpu.vdirty = true;
+
+  PS_set_status(status & ~(SSTATUS_FS | SSTATUS_VS));
+}
+
+uint64_t fpu_user_status(proc_t *p, uint64_t sstatus) {
+  sstatus &= ~(SSTATUS_FS | SSTATUS_VS);
+
+  // clean, so the hardware tells us whether the proc writes them
+  if (fpu_loaded(current_cpu(), p)) {
+    if (p->fpu.used)
+      sstatus |= SSTATUS_FS_CLEAN;
+    if (p->fpu.vused)
+      sstatus |= SSTATUS_VS_CLEAN;
+  }
+
+  return sstatus;
+}
+
+void fpu_switch_out(cpu_t *c, proc_t *p) {
+  // keep the registers loaded, only write back what changed so the proc
+  // can resume on any hart
+  if (fpu_loaded(c, p) && (p->fpu.dirty || p->fpu.vdirty))
+    fpu_save(p);
+}
+
+static int csr_unit(uint32_t csr) {
+  switch (csr) {
+  case 0x001: /* fflags */
+  case 0x002: /* frm */
+  case 0x003: /* fcsr */
+    return UNIT_FP;
+  case 0x008: /* vstart */
+  case 0x009: /* vxsat */
+  case 0x00a: /* vxrm */
+  case 0x00f: /* vcsr */
+  case 0xc20: /* vl */
+  case 0xc21: /* vtype */
+  case CSR_VLENB:
+    return UNIT_VEC;
+  default:
+    return UNIT_NONE;
+  }
+}
+
+/* the unit that has to be on for `insn` to execute */
+static int insn_unit(uint32_t insn) {
+  if ((insn & 0x3) != 0x3) {
+    // compressed: c.fld/c.fsd and c.fldsp/c.fsdsp (funct3 001 and 101)
+    uint32_t quadrant = insn & 0x3, funct3 = (insn >> 13) & 0x7;
+    if (quadrant != 1 && (funct3 == 1 || funct3 == 5))
+      return UNIT_FP;
+    return UNIT_NONE;
+  }
+
+  uint32_t funct3 = (insn >> 12) & 0x7;
+  switch (insn & 0x7f) {
+  case 0x07: /* LOAD-FP */
+  case 0x27: /* STORE-FP */
+    // widths 1-4 are h/w/d/q, the others are vector element widths
+    return funct3 >= 1 && funct3 <= 4 ? UNIT_FP : UNIT_VEC;
+  case 0x43: /* FMADD */
+  case 0x47: /* FMSUB */
+  case 0x4b: /* FNMSUB */
+  case 0x4f: /* FNMADD */
+  case 0x53: /* OP-FP */
+    return UNIT_FP;
+  case 0x57: /* OP-V, vset{i}vl{i} included */
+    return UNIT_VEC;
+  case 0x73: /* SYSTEM: csrr* with funct3 1-3 and 5-7 */
+    if (funct3 == 0 || funct3 == 4)
+      return UNIT_NONE;
+    return csr_unit(insn >> 20);
+  default:
+    return UNIT_NONE;
+  }
+}
+
+/* the instruction that trapped, from stval or else read at sepc */
+static uint32_t faulting_insn(proc_t *p) {
+  uint32_t insn = (uint32_t)PS_get_exception_value();
+  if (insn)
+    return insn;
+
+  uint64_t pc = PS_get_exception_pc();
+  uint16_t half[2] = {0, 0};
+  if (!result_is_ok(copyin(p->pagetable, &half[0], pc, 2)))
+    return 0;
+  if ((half[0] & 0x3) == 0x3 &&
+      !result_is_ok(copyin(p->pagetable, &half[1], pc + 2, 2)))
+    return 0;
+
+  return half[0] | ((uint32_t)half[1] << 16);
+}
+
+g_bool fpu_handle_illegal(proc_t *p) {
+  g_bool retry = true;
+
+  // decode first: an illegal instruction that needs neither unit must not
+  // turn one on or allocate vector state
+  int unit = insn_unit(faulting_insn(p));
+  if (unit == UNIT_NONE || (unit == UNIT_FP && !has_fpu) ||
+      (unit == UNIT_VEC && !has_vec))
+    return false;
+
+  intr_push_off();
+  cpu_t *c = current_cpu();
+
+  if (unit == UNIT_FP && !p->fpu.used) {
+    p->fpu.used = true;
+  } else if (unit == UNIT_VEC && !p->fpu.vused) {
+    if (vec_alloc(&p->fpu))
+      p->fpu.vused = true;
+    else
+      retry = false;
+  } else if (fpu_loaded(c, p)) {
+    // the unit it needs is on and loaded: a genuinely illegal instruction
+    retry = false;
+  }
+
+  // also reloads if the unit was off because another proc (or nobody) held it
+  if (retry) {
+    // the other unit may be live with changes fpu_load() would overwrite
+    if (fpu_loaded(c, p))
+      fpu_save(p);
+    fpu_load(c, p);
+  }
+
+  intr_pop_off();
+  return retry;
+}
+
+void fpu_kernel_begin(void) {
+  intr_push_off();
+  cpu_t *c = current_cpu();
+
+  // the kernel is about to overwrite whatever state the hart holds
+  if (c->fpu_owner && fpu_loaded(c, c->fpu_owner))
+    fpu_save(c->fpu_owner);
+  c->fpu_owner = NULL;
+
+  PS_set_status(PS_get_status() | SSTATUS_FS_CLEAN);
+}
+
+void fpu_kernel_end(void) {
+  PS_set_status(PS_get_status() & ~(SSTATUS_FS | SSTATUS_VS));
+  intr_pop_off();
+}
@@ -0,0 +1,85 @@
+#pragma once
+/*
+ * Lazy floating point and vector context switching.
+ *
+ * Procs start with sstatus.FS and sstatus.VS off, so their first F/D or V
+ * instruction raises an illegal instruction trap. fpu_handle_illegal() then
+ * loads the proc's saved registers (zeroes on first use) and turns the unit
+ * on for it. A hart remembers whose registers it holds: a proc returning to
+ * the hart that still holds its state runs with the unit on and no reload.
+ *
+ * The hardware marks FS/VS dirty when user code writes the registers. The
+ * state is only saved when a proc that dirtied it is switched out. The
+ * vector register file (32 * vlenb bytes) lives in a per-proc area that is
+ * allocated on the first vector instruction.
+ *
+ * The kernel is built soft-float and runs with both units off. Kernel code
+ * that wants to use them directly must call fpu_kernel_begin()/end().
+ */
+
+#include <lib/types.h>
+#include <stdint.h>
+
+struct proc;
+struct cpu;
+
+struct fpu_regs {
+  uint64_t f[32];
+  uint64_t fcsr;
+};
+
+/* followed by v0-v31, see fpu.S */
+struct vec_regs {
+  uint64_t vstart;
+  uint64_t vl;
+  uint64_t vtype;
+  uint64_t vcsr;
+  uint8_t v[];
+};
+
+typedef struct fpu_state {
+  struct fpu_regs regs;
+  struct vec_regs *vregs; /* allocated on first vector use */
+  int vorder;             /* buddy order of `vregs` */
+
+  int cpu;        /* hart holding this state in its registers, -1 if none */
+  g_bool used;    /* F/D enabled for the proc */
+  g_bool vused;   /* V enabled for the proc */
+  g_bool dirty;   /* registers on `cpu` are newer than `regs` */
+  g_bool vdirty;  /* likewise for `vregs` */
+} fpu_state_t;
+
+/* Probes the F/D and V units of the calling hart. */
+void fpu_init(void);
+
+/* Resets the state of a new proc. */
+void fpu_state_init(fpu_state_t *s);
+
+/* Frees the vector area. */
+void fpu_state_free(fpu_state_t *s);
+
+/* Copies the parent's state to a forked child. Called by the parent. */
+g_bool fpu_fork(struct proc *parent, struct proc *child);
+
+/* On entry from user mode: notes what the proc dirtied, turns the units off */
+void fpu_user_enter(struct proc *p);
+
+/* sstatus value to return to user mode with, given the current one */
+uint64_t fpu_user_status(struct proc *p, uint64_t sstatus);
+
+/* Called by the scheduler once `p` stopped running on hart `c`. */
+void fpu_switch_out(struct cpu *c, struct proc *p);
+
+/*
+ * Handles an illegal instruction trap from user mode. Decodes the faulting
+ * instruction and returns true if the F/D or V unit it needs was turned on
+ * and it should be retried, false for anything else.
+ */
+g_bool fpu_handle_illegal(struct proc *p);
+
+/*
+ * Lets kernel code use F/D registers (through inline asm or a file built
+ * with hard float) until fpu_kernel_end(). Interrupts stay off meanwhile.
+ */
+void fpu_kernel_begin(void);
+void fpu_kernel_end(void);
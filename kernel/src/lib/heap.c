@@ -0,0 +1,134 @@
+#include "heap.h"
+#include "buddy_allocator.h"
+#include <lib/memory.h>
+#include <lib/panic.h>
+
+#define HEAP_BLOCK_SIZE(order) (4096UL << (order))
+#define HEAP_MAX_ORDER 10
+
+static void heap_set(heap_t *h, g_usize i, heap_node_t *n) {
+  h->nodes[i] = n;
+  n->index = i;
+}
+
+static void sift_up(heap_t *h, g_usize i) {
+  heap_node_t *n = h->nodes[i];
+
+  while (i > 1) {
+    heap_node_t *parent = h->nodes[i / 2];
+    if (parent->key <= n->key)
+      break;
+    heap_set(h, i, parent);
+    i /= 2;
+  }
+
+  heap_set(h, i, n);
+}
+
+static void sift_down(heap_t *h, g_usize i) {
+  heap_node_t *n = h->nodes[i];
+
+  for (;;) {
+    g_usize child = i * 2;
+    if (child > h->len)
+      break;
+    if (child + 1 <= h->len && h->nodes[child + 1]->key < h->nodes[child]->key)
+      child++;
+    if (n->key <= h->nodes[child]->key)
+      break;
+    heap_set(h, i, h->nodes[child]);
+    i = child;
+  }
+
+  heap_set(h, i, n);
+}
+
+static g_bool heap_grow(heap_t *h) {
+  if (h->order >= HEAP_MAX_ORDER)
+    return false;
+
+  heap_node_t **nodes = buddy_alloc_pages(h->order + 1);
+  if (!nodes)
+    return false;
+
+  memcpy(nodes, h->nodes, (h->len + 1) * sizeof(heap_node_t *));
+  buddy_free_pages(h->nodes, h->order);
+
+  h->nodes = nodes;
+  h->order++;
+  h->cap = HEAP_BLOCK_SIZE(h->order) / sizeof(heap_node_t *);
+  return true;
+}
+
+g_bool heap_init(heap_t *h) {
+  if (!h)
+    return false;
+
+  h->order = 0;
+  h->nodes = buddy_alloc_pages(h->order);
+  if (!h->nodes)
+    return false;
+
+  h->len = 0;
+  h->cap = HEAP_BLOCK_SIZE(h->order) / sizeof(heap_node_t *);
+  return true;
+}
+
+void heap_destroy(heap_t *h) {
+  if (h->len)
+    panic("heap_destroy: heap not empty");
+
+  buddy_free_pages(h->nodes, h->order);
+  h->nodes = NULL;
+  h->cap = 0;
+}
+
+g_bool heap_push(heap_t *h, heap_node_t *n) {
+  if (heap_node_queued(n))
+    panic("heap_push: node already queued");
+
+  if (h->len + 1 >= h->cap && !heap_grow(h))
+    return false;
+
+  h->len++;
+  heap_set(h, h->len, n);
+  sift_up(h, h->len);
+  return true;
+}
+
+void heap_remove(heap_t *h, heap_node_t *n) {
+  g_usize i = n->index;
+  if (i == 0 || i > h->len || h->nodes[i] != n)
+    panic("heap_remove: node not on this heap");
+
+  heap_node_t *last = h->nodes[h->len];
+  h->nodes[h->len] = NULL;
+  h->len--;
+  n->index = 0;
+
+  if (last == n)
+    return;
+
+  heap_set(h, i, last);
+  if (i > 1 && h->nodes[i / 2]->key > last->key)
+    sift_up(h, i);
+  else
+    sift_down(h, i);
+}
+
+void heap_update(heap_t *h, heap_node_t *n, uint64_t key) {
+  uint64_t old = n->key;
+  n->key = key;
+
+  if (key < old)
+    sift_up(h, n->index);
+  else
+    sift_down(h, n->index);
+}
+
+heap_node_t *heap_pop(heap_t *h) {
+  heap_node_t *n = heap_peek(h);
+  if (n)
+    heap_remove(h, n);
+  return n;
+}
@@ -0,0 +1,61 @@
+#pragma once
+/*
+ * Intrusive binary min-heap.
+ *
+ * Elements embed a `heap_node_t` and are ordered by its `key`. The heap only
+ * stores pointers to the nodes, in a block obtained from the buddy allocator
+ * that doubles in size when it fills up, so there is no fixed capacity.
+ *
+ * Slots are 1-based; a node's `index` is its slot, and 0 means the node is
+ * not on any heap. Zero-initialised nodes therefore start out unqueued.
+ *
+ * Example:
+ *     heap_t h;
+ *     heap_init(&h);
+ *     t->node.key = deadline;
+ *     heap_push(&h, &t->node);
+ *     heap_node_t *first = heap_peek(&h);
+ */
+
+#include <lib/macros.h>
+#include <lib/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct heap_node {
+  uint64_t key;
+  g_usize index; /* slot in the heap, 0 when not queued */
+} heap_node_t;
+
+typedef struct heap {
+  heap_node_t **nodes; /* nodes[1..len] */
+  g_usize len;
+  g_usize cap; /* number of slots, including the unused slot 0 */
+  int order;   /* buddy order of `nodes` */
+} heap_t;
+
+g_bool heap_init(heap_t *h);
+
+/* Releases the backing block. The heap must be empty. */
+void heap_destroy(heap_t *h);
+
+/* Adds `n` with its current key. Fails only if the heap cannot grow. */
+g_bool heap_push(heap_t *h, heap_node_t *n);
+
+/* Removes `n`, which must be on `h`. */
+void heap_remove(heap_t *h, heap_node_t *n);
+
+/* Changes the key of `n`, which must be on `h`, and restores heap order. */
+void heap_update(heap_t *h, heap_node_t *n, uint64_t key);
+
+heap_node_t *heap_pop(heap_t *h);
+
+G_INLINE heap_node_t *heap_peek(heap_t *h) {
+  return h->len ? h->nodes[1] : NULL;
+}
+
+G_INLINE g_usize heap_len(heap_t *h) { return h->len; }
+
+G_INLINE g_bool heap_node_queued(const heap_node_t *n) {
+  return n->index != 0;
+}
@@ -0,0 +1,186 @@
+#include "intr_trace.h"
+#include "lib/cpu.h"
+#include "lib/print.h"
+#include "lib/time.h"
+#include "lib/timer.h"
+#include "proc.h"
+
+#ifdef INTR_TRACE
+
+typedef struct intr_site {
+  void *site; /* NULL while the slot is free */
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t hist[INTR_TRACE_BUCKETS];
+} intr_site_t;
+
+/* the stretch running on each hart */
+typedef struct intr_span {
+  uint64_t start;
+  void *site;
+} intr_span_t;
+
+/*
+ * Updated with atomics only: this runs inside acquire() and release(), so it
+ * cannot take a lock of its own.
+ */
+static intr_site_t sites[INTR_TRACE_SITES];
+static intr_span_t spans[NCPU];
+static uint64_t dropped;
+
+/* finds or claims the slot of `site`, NULL if the table is full */
+static intr_site_t *site_slot(void *site) {
+  uint64_t h = ((uint64_t)site >> 1) * 0x9E3779B97F4A7C15ULL;
+
+  for (int i = 0; i < INTR_TRACE_SITES; i++) {
+    intr_site_t *s = &sites[(h + i) & (INTR_TRACE_SITES - 1)];
+    void *cur = __atomic_load_n(&s->site, __ATOMIC_ACQUIRE);
+
+    if (cur == site)
+      return s;
+    if (cur == NULL) {
+      void *expected = NULL;
+      if (__atomic_compare_exchange_n(&s->site, &expected, site, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+          expected == site)
+        return s;
+    }
+  }
+
+  return NULL;
+}
+
+void intr_trace_begin(struct cpu *c, void *site) {
+  intr_span_t *span = &spans[cpu_id(c)];
+  span->site = site;
+  span->start = get_time_in_cycles();
+}
+
+void intr_trace_end(struct cpu *c) {
+  intr_span_t *span = &spans[cpu_id(c)];
+  if (!span->start)
+    return; // interrupts went off before the tracer saw it
+
+  uint64_t cycles = get_time_in_cycles() - span->start;
+  span->start = 0;
+
+  intr_site_t *s = site_slot(span->site);
+  if (!s) {
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  int bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+  if (bucket >= INTR_TRACE_BUCKETS)
+    bucket = INTR_TRACE_BUCKETS - 1;
+
+  __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->total, cycles, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->hist[bucket], 1, __ATOMIC_RELAXED);
+
+  uint64_t max = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+  while (cycles > max &&
+         !__atomic_compare_exchange_n(&s->max, &max, cycles, false,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static void print_site(intr_site_t *s) {
+  printf("%{type: hex}: %{type: int} times, max %{type: int} cycles, avg "
+         "%{type: int}\n",
+         PRINT_FLAG_BOTH, (uint64_t)s->site, s->count, s->max,
+         s->total / s->count);
+
+  for (int i = 0; i < INTR_TRACE_BUCKETS; i++) {
+    if (s->hist[i])
+      printf("    >= %{type: int} cycles: %{type: int}\n", PRINT_FLAG_BOTH,
+             1UL << i, s->hist[i]);
+  }
+}
+
+void intr_trace_print(int n) {
+  // printing takes locks and so feeds the table; report what came before
+  static intr_site_t snapshot[INTR_TRACE_SITES];
+  static g_bool shown[INTR_TRACE_SITES];
+
+  for (int i = 0; i < INTR_TRACE_SITES; i++) {
+    snapshot[i] = sites[i];
+    shown[i] = false;
+  }
+  uint64_t lost = dropped;
+
+  printf("interrupt-off stretches, longest first:\n", PRINT_FLAG_BOTH);
+  for (int k = 0; k < n; k++) {
+    int worst = -1;
+    for (int i = 0; i < INTR_TRACE_SITES; i++) {
+      if (shown[i] || !snapshot[i].site || !snapshot[i].count)
+        continue;
+      if (worst < 0 || snapshot[i].max > snapshot[worst].max)
+        worst = i;
+    }
+    if (worst < 0)
+      break;
+
+    shown[worst] = true;
+    print_site(&snapshot[worst]);
+  }
+
+  if (lost)
+    printf("%{type: int} stretches from untracked sites\n", PRINT_FLAG_BOTH,
+           lost);
+}
+
+void intr_trace_reset(void) {
+  // a site being updated meanwhile may keep part of its old counts
+  for (int i = 0; i < INTR_TRACE_SITES; i++) {
+    intr_site_t *s = &sites[i];
+    __atomic_store_n(&s->count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->total, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->max, 0, __ATOMIC_RELAXED);
+    for (int b = 0; b < INTR_TRACE_BUCKETS; b++)
+      __atomic_store_n(&s->hist[b], 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+}
+
+/* dumps the worst sites of the last period, then starts a new one */
+static void irqtraced(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    sleep_ms(INTR_TRACE_DUMP_MS);
+    intr_trace_print(INTR_TRACE_DUMP_SITES);
+    intr_trace_reset();
+  }
+}
+
+void intr_trace_init(void) {
+  kernel_task_opts_t opts = {
+      .priority = PROC_PRIORITY_LOW,
+  };
+
+  result_t r = make_kernel_task_opts(irqtraced, NULL, "irqtraced", &opts);
+  if (!result_is_ok(r))
+    printf("intr_trace: failed to start irqtraced\n", PRINT_FLAG_BOTH);
+}
+
+#else
+
+void intr_trace_begin(struct cpu *c, void *site) {
+  (void)c;
+  (void)site;
+}
+
+void intr_trace_end(struct cpu *c) { (void)c; }
+
+void intr_trace_print(int n) {
+  (void)n;
+  printf("intr_trace: build with -DINTR_TRACE\n", PRINT_FLAG_BOTH);
+}
+
+void intr_trace_reset(void) {}
+
+void intr_trace_init(void) {}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+/*
+ * Interrupt-off latency tracer.
+ *
+ * Built only with -DINTR_TRACE. Every stretch in which a hart had interrupts
+ * turned off by intr_push_off() (and so by acquire()) is timed with rdcycle,
+ * from noff going 0 -> 1 with interrupts on until it drops back to 0. The
+ * time is charged to the code that pushed first: the caller of
+ * intr_push_off(), or of acquire() for a spinlock.
+ *
+ * Per call site the tracer keeps the count, total, maximum and a log2
+ * histogram of the cycles. intr_trace_print() lists the sites with the
+ * longest maximum; resolve the addresses with addr2line against the kernel.
+ * The irqtraced task prints them every INTR_TRACE_DUMP_MS and starts over,
+ * and stats_print() includes them.
+ */
+
+#include <lib/types.h>
+#include <stdint.h>
+
+/* call sites tracked, a power of two; later sites are counted as dropped */
+#ifndef INTR_TRACE_SITES
+#define INTR_TRACE_SITES 128
+#endif
+
+/* histogram bucket i counts stretches of [2^i, 2^(i+1)) cycles */
+#define INTR_TRACE_BUCKETS 32
+
+/* how often irqtraced dumps the table, and how many sites it shows */
+#ifndef INTR_TRACE_DUMP_MS
+#define INTR_TRACE_DUMP_MS 10000
+#endif
+#define INTR_TRACE_DUMP_SITES 8
+
+struct cpu;
+
+/* Interrupts just went off on `c`, at the request of `site`. */
+void intr_trace_begin(struct cpu *c, void *site);
+
+/* Interrupts are about to go back on on `c`. */
+void intr_trace_end(struct cpu *c);
+
+/* Prints the `n` sites with the longest interrupt-off stretch. */
+void intr_trace_print(int n);
+
+/* Forgets everything recorded so far. */
+void intr_trace_reset(void);
+
+/* Starts irqtraced. Does nothing without INTR_TRACE. */
+void intr_trace_init(void);
@@ -0,0 +1,72 @@
+#pragma once
+/*
+ * Intrusive doubly-linked list.
+ *
+ * A list is a circular chain of `list_node_t` anchored at a head node. The
+ * nodes live inside the structures being linked, so inserting or removing an
+ * element never allocates. A node that is not on any list has NULL links,
+ * which means zero-initialised structures start out unlinked.
+ *
+ * Example:
+ *     list_node_t queue;
+ *     list_init(&queue);
+ *     list_push_back(&queue, &p->wait_node);
+ *     proc_t *first = LIST_ENTRY(queue.next, proc_t, wait_node);
+ */
+
+#include <lib/macros.h>
+#include <lib/types.h>
+#include <stddef.h>
+
+typedef struct list_node {
+  struct list_node *prev;
+  struct list_node *next;
+} list_node_t;
+
+#define LIST_ENTRY(node, type, member)                                         \
+  ((type *)((char *)(node) - offsetof(type, member)))
+
+#define LIST_FOR_EACH(it, head)                                                \
+  for (list_node_t *it = (head)->next; it != (head); it = it->next)
+
+/* iteration that tolerates removal of the current node */
+#define LIST_FOR_EACH_SAFE(it, tmp, head)                                      \
+  for (list_node_t *it = (head)->next, *tmp = it->next; it != (head);         \
+       it = tmp, tmp = it->next)
+
+G_INLINE void list_init(list_node_t *head) {
+  head->prev = head;
+  head->next = head;
+}
+
+G_INLINE g_bool list_empty(const list_node_t *head) {
+  return head->next == head;
+}
+
+/* true if the node is currently on some list */
+G_INLINE g_bool list_linked(const list_node_t *node) {
+  return node->next != NULL;
+}
+
+/* insert `node` directly in front of `pos` */
+G_INLINE void list_insert_before(list_node_t *pos, list_node_t *node) {
+  node->prev = pos->prev;
+  node->next = pos;
+  pos->prev->next = node;
+  pos->prev = node;
+}
+
+G_INLINE void list_push_back(list_node_t *head, list_node_t *node) {
+  list_insert_before(head, node);
+}
+
+G_INLINE void list_push_front(list_node_t *head, list_node_t *node) {
+  list_insert_before(head->next, node);
+}
+
+G_INLINE void list_remove(list_node_t *node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->prev = NULL;
+  node->next = NULL;
+}
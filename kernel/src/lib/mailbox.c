@@ -1,10 +1,13 @@
 #include "mailbox.h"
-#include <lib/dyn_array.h>
 #include <lib/memory.h>
 #include <lib/notification.h>
+#include <page_table.h>
 #include <physical_alloc.h>
+#include <lib/cpu.h>
+#include <lib/usermem.h>
+#include <proc.h>
 
-#define MAILBOX_SIZE 8
+_Static_assert(sizeof(mailbox_t) <= PAGE_SIZE, "mailbox must fit a page");
 
 RESULT_TYPE(mailbox_t *) make_mailbox() {
   mailbox_t *mb = (mailbox_t *)alloc_page();
@@ -13,15 +16,81 @@ RESULT_TYPE(mailbox_t *) make_mailbox() {
   }
   memset(mb, 0, sizeof(mailbox_t));
 
-  result_t rout = make_dyn_array(sizeof(notification_t), MAILBOX_SIZE);
-  if (!result_is_ok(rout)) {
-    free_page(mb);
-    return RESULT_FAILURE(RESULT_NOMEM);
+  initlock(&mb->lock, "mailbox");
+
+  return RESULT_SUCCESS(mb);
+}
+
+void free_mailbox(mailbox_t *mb) {
+  if (!mb)
+    return;
+
+  free_page(mb);
+}
+
+void mailbox_reset(mailbox_t *mb) {
+  acquire(&mb->lock);
+  mb->head = 0;
+  mb->count = 0;
+  release(&mb->lock);
+}
+
+RESULT_TYPE(void) mailbox_post(mailbox_t *mb, const notification_t *n) {
+  acquire(&mb->lock);
+  if (mb->count == MAILBOX_CAPACITY) {
+    release(&mb->lock);
+    return RESULT_FAILURE(RESULT_BUSY);
   }
+  mb->ring[(mb->head + mb->count) % MAILBOX_CAPACITY] = *n;
+  mb->count++;
+  release(&mb->lock);
 
-  mb->incoming = (notification_queue_t *)result_unwrap(rout);
+  wakeup(mb);
+  return RESULT_SUCCESS(0);
+}
 
-  initlock(&mb->lock, "mailbox");
+RESULT_TYPE(void) mailbox_send(proc_t *to, const notification_t *n) {
+  result_t r = mailbox_post(to->mailbox, n);
+  if (!result_is_ok(r))
+    return r;
 
-  return RESULT_SUCCESS(mb);
+  // the receiver was just woken, run it now rather than at the next pick
+  yield_to(to);
+  return RESULT_SUCCESS(0);
+}
+
+g_bool mailbox_receive(mailbox_t *mb, notification_t *out) {
+  acquire(&mb->lock);
+  while (mb->count == 0) {
+    if (killed(current_proc())) {
+      release(&mb->lock);
+      return false;
+    }
+    sleep(mb, &mb->lock);
+  }
+  *out = mb->ring[mb->head];
+  mb->head = (mb->head + 1) % MAILBOX_CAPACITY;
+  mb->count--;
+  release(&mb->lock);
+  return true;
+}
+
+RESULT_TYPE(void) mailbox_receive_user(proc_t *p, uint64_t addr) {
+  // it sleeps as the caller, an io_ring poller cannot block for it
+  if (p != current_proc())
+    return RESULT_FAILURE(RESULT_INVALID);
+  if (!user_writable(p->pagetable, addr, sizeof(mailbox_msg_t)))
+    return RESULT_FAILURE(RESULT_FAULT);
+
+  notification_t n;
+  if (!mailbox_receive(p->mailbox, &n))
+    return RESULT_SUCCESS(0); /* killed, it will not look */
+
+  mailbox_msg_t msg = {
+      .token = n.token,
+      .type = n.type,
+      .value = n.value,
+      .sender = n.sender,
+  };
+  return copyout(p->pagetable, addr, &msg, sizeof(msg));
 }
@@ -4,9 +4,61 @@
 #include <lib/types.h>
 #include <lib/notification.h>
 
+/* notifications a mailbox holds; posting to a full one fails */
+#define MAILBOX_CAPACITY 64
+
+/*
+ * A fixed ring in one page, so posting never allocates and can be done from
+ * interrupt context.
+ */
 typedef struct mailbox {
-    notification_queue_t* incoming;
     struct spinlock lock;
+    uint32_t head;  /* oldest notification */
+    uint32_t count;
+    notification_t ring[MAILBOX_CAPACITY];
 } mailbox_t;
 
 RESULT_TYPE(mailbox_t*) make_mailbox();
+void free_mailbox(mailbox_t *mb);
+
+/* Drops every queued notification, for a mailbox being reused. */
+void mailbox_reset(mailbox_t *mb);
+
+/*
+ * Queues a copy of `n` in `mb` and wakes its receiver. Fails with
+ * RESULT_BUSY if `mb` is full. Does not block, allocate or switch, so it is
+ * safe from interrupt context.
+ */
+RESULT_TYPE(void) mailbox_post(mailbox_t *mb, const notification_t *n);
+
+/*
+ * Posts `n` to `to`'s mailbox and hands the rest of the caller's timeslice to
+ * `to`, so a request/response round trip costs one switch each way. Process
+ * context only, with no locks held.
+ */
+RESULT_TYPE(void) mailbox_send(proc_t *to, const notification_t *n);
+
+/*
+ * Blocks until `mb` holds a notification and moves the oldest one to `out`.
+ * Returns false if the caller was killed while waiting.
+ */
+g_bool mailbox_receive(mailbox_t *mb, notification_t *out);
+
+/*
+ * A notification as SYS_MAILBOX_RECEIVE copies it out. Procs send each other
+ * NOTIFICATION_TYPE_GIZMO with a 32-bit value, kernel notifications put
+ * theirs in the same field.
+ */
+typedef struct mailbox_msg {
+  uint64_t token;
+  uint32_t type;   /* notification_type_t */
+  uint32_t value;  /* notification_t.value */
+  uint64_t sender; /* pid, 0 for the kernel */
+} mailbox_msg_t;
+
+/*
+ * Waits for the next notification to `p`, the running proc, and copies it
+ * to user address `addr` as a mailbox_msg_t. The destination is checked
+ * before the notification is taken, so a bad address loses nothing.
+ */
+RESULT_TYPE(void) mailbox_receive_user(proc_t *p, uint64_t addr);
@@ -17,6 +17,8 @@ typedef struct notification {
     notification_type_t type;
     uint32_t data_size;
     void *data;
+    uint32_t value; /* inline payload, e.g. a proc_send() value or a byte count */
+    int sender; /* pid of the sending proc, 0 if the kernel sent it */
 } notification_t;
 
 // forward declaration of proc_t
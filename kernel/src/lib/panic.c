@@ -25,6 +25,7 @@ void fill_fb_with_panic_color() {
 }
 
 void panic(const char *msg) {
+  shared_uart_set_polled();
   if (!is_shared_char_available()) {
     fill_fb_with_panic_color();
   }
@@ -37,6 +38,7 @@ void panic(const char *msg) {
 }
 
 void panic_location_internal(const char *msg, const char *file, int line) {
+  shared_uart_set_polled();
   if (!is_shared_char_available()) {
     fill_fb_with_panic_color();
   }
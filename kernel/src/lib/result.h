@@ -12,6 +12,8 @@ typedef enum {
   RESULT_BUSY,
   RESULT_NOTIMPL,
   RESULT_NOT_FOUND,
+  RESULT_TIMEOUT,
+  RESULT_FAULT,
 } result_code_t;
 
 typedef struct {
@@ -111,6 +111,16 @@ G_INLINE struct sbiret sbi_system_reset(uint32_t reset_type, uint32_t reset_reas
 #define SBI_SRST_REASON_NONE 0x0
 #define SBI_SRST_REASON_FAILURE 0x1
 
+// inter-processor interrupts
+#define SBI_EID_IPI         0x735049
+#define SBI_EID_IPI_FID_SEND_IPI 0x0
+
+G_INLINE struct sbiret sbi_send_ipi(unsigned long hart_mask,
+                                    unsigned long hart_mask_base) {
+  return sbicall(SBI_EID_IPI, SBI_EID_IPI_FID_SEND_IPI, hart_mask,
+                 hart_mask_base);
+}
+
 // timer
 #define SBI_EID_TIME        0x54494D45
 #define SBI_EID_TIME_FID_SET_TIMER 0x0
@@ -0,0 +1,76 @@
+#include "slab.h"
+#include "buddy_allocator.h"
+#include <lib/panic.h>
+#include <stddef.h>
+
+#define SLAB_BLOCK_SIZE(order) (4096UL << (order))
+#define SLAB_MAX_ORDER 10
+#define SLAB_MIN_OBJECTS 8 /* objects per block, unless that needs > max */
+
+void slab_cache_init(slab_cache_t *c, char *name, g_usize obj_size) {
+  initlock(&c->lock, name);
+
+  if (obj_size < sizeof(void *))
+    obj_size = sizeof(void *);
+  c->obj_size = (obj_size + 15) & ~(g_usize)15;
+
+  c->order = 0;
+  while (c->order < SLAB_MAX_ORDER &&
+         SLAB_BLOCK_SIZE(c->order) < c->obj_size * SLAB_MIN_OBJECTS)
+    c->order++;
+
+  if (SLAB_BLOCK_SIZE(c->order) < c->obj_size)
+    panic("slab_cache_init: object too large");
+
+  c->free = NULL;
+  c->nr_blocks = 0;
+  c->nr_free = 0;
+  c->nr_allocated = 0;
+}
+
+/* adds a block of free objects. c->lock held. */
+static g_bool slab_grow(slab_cache_t *c) {
+  char *block = buddy_alloc_pages(c->order);
+  if (!block)
+    return false;
+
+  g_usize count = SLAB_BLOCK_SIZE(c->order) / c->obj_size;
+  for (g_usize i = 0; i < count; i++) {
+    void **obj = (void **)(block + i * c->obj_size);
+    *obj = c->free;
+    c->free = obj;
+  }
+
+  c->nr_blocks++;
+  c->nr_free += count;
+  return true;
+}
+
+void *slab_alloc(slab_cache_t *c) {
+  acquire(&c->lock);
+
+  if (!c->free && !slab_grow(c)) {
+    release(&c->lock);
+    return NULL;
+  }
+
+  void **obj = c->free;
+  c->free = *obj;
+  c->nr_free--;
+  c->nr_allocated++;
+
+  release(&c->lock);
+  return obj;
+}
+
+void slab_free(slab_cache_t *c, void *obj) {
+  if (!obj)
+    return;
+
+  acquire(&c->lock);
+  *(void **)obj = c->free;
+  c->free = obj;
+  c->nr_free++;
+  c->nr_allocated--;
+  release(&c->lock);
+}
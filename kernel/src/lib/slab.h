@@ -0,0 +1,37 @@
+#pragma once
+/*
+ * Fixed-size object cache.
+ *
+ * Objects are carved out of blocks from the buddy allocator, several per
+ * block, and freed objects are kept on a free list (linked through their
+ * first word) for the next slab_alloc(). Blocks are never returned to the
+ * buddy allocator, so a cache only ever grows to its peak usage.
+ *
+ * Example:
+ *     slab_cache_t cache;
+ *     slab_cache_init(&cache, "proc", sizeof(proc_t));
+ *     proc_t *p = slab_alloc(&cache);
+ *     slab_free(&cache, p);
+ */
+
+#include <lib/spinlock.h>
+#include <lib/types.h>
+#include <stdint.h>
+
+typedef struct slab_cache {
+  struct spinlock lock;
+  g_usize obj_size; /* bytes per object, rounded up to 16 */
+  int order;        /* buddy order of each block */
+  void *free;       /* free objects */
+
+  uint64_t nr_blocks;
+  uint64_t nr_free;
+  uint64_t nr_allocated;
+} slab_cache_t;
+
+void slab_cache_init(slab_cache_t *c, char *name, g_usize obj_size);
+
+/* Returns an uninitialised object, or NULL if the cache cannot grow. */
+void *slab_alloc(slab_cache_t *c);
+
+void slab_free(slab_cache_t *c, void *obj);
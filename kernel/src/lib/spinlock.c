@@ -20,7 +20,8 @@ g_bool holding(struct spinlock *lk) {
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 void acquire(struct spinlock *lk) {
-  intr_push_off(); // disable interrupts to avoid deadlock.
+  // disable interrupts to avoid deadlock, charged to our caller
+  intr_push_off_at(__builtin_return_address(0));
   if (holding(lk))
     panic("acquire");
 
@@ -1,15 +1,15 @@
 #include "device/shared.h"
 #include <device/rtc.h>
+#include <lib/cpu.h>
 #include <lib/fmt.h>
 #include <lib/print.h>
 #include <lib/str.h>
 #include <lib/time.h>
+#include <lib/timer.h>
 #include <physical_alloc.h>
+#include <proc.h>
 #include <stdint.h>
 
-// Global variable that represents the time that sleep should end
-static uint64_t sleep_end = 0;
-
 // Array of days in each month (non-leap year)
 static const uint8_t days_in_month[] = {31, 28, 31, 30, 31, 30,
                                         31, 31, 30, 31, 30, 31};
@@ -121,56 +121,35 @@ void time_to_string(const time_t *tm, char *buf) {
   free_page(f);
 }
 
-void sleep_s(uint32_t seconds) {
-  // Convert time to ns
-  uint64_t ns = (uint64_t)seconds * 1000000000ULL;
-  uint64_t current_time = shared_rtc_get_time();
+/*
+ * Sleeps for `ticks` of the `time` CSR. A proc blocks on a kernel timer and
+ * gives up its hart; outside of a proc (early boot, the scheduler itself)
+ * there is nothing to switch to, so we poll instead.
+ */
+static void sleep_ticks(uint64_t ticks) {
+  uint64_t deadline = get_csrr_time() + ticks;
+
+  if (current_proc()) {
+    sleep_until(deadline);
+    return;
+  }
 
-  // Set the end time
-  sleep_end = current_time + ns;
+  while (get_csrr_time() < deadline)
+    ;
+}
 
-  // Wait until the end time
-  while (shared_rtc_get_time() < sleep_end) {
-    asm volatile("wfi");
-  }
+void sleep_s(uint32_t seconds) {
+  sleep_ticks((uint64_t)seconds * TIMER_FREQUENCY);
 }
 
 void sleep_ms(uint32_t milliseconds) {
-  // Convert time to ns
-  uint64_t ns = (uint64_t)milliseconds * 1000000ULL;
-  uint64_t current_time = shared_rtc_get_time();
-
-  // Set the end time
-  sleep_end = current_time + ns;
-
-  // Wait until the end time
-  while (shared_rtc_get_time() < sleep_end) {
-    asm volatile("wfi");
-  }
+  sleep_ticks(timer_us_to_ticks((uint64_t)milliseconds * 1000ULL));
 }
 
 void sleep_us(uint32_t microseconds) {
-  // Convert time to ns
-  uint64_t ns = (uint64_t)microseconds * 1000ULL;
-  uint64_t current_time = shared_rtc_get_time();
-
-  // Set the end time
-  sleep_end = current_time + ns;
-
-  // Wait until the end time
-  while (shared_rtc_get_time() < sleep_end) {
-    asm volatile("wfi");
-  }
+  sleep_ticks(timer_us_to_ticks(microseconds));
 }
 
 void sleep_ns(uint32_t nanoseconds) {
-  uint64_t current_time = shared_rtc_get_time();
-
-  // Set the end time
-  sleep_end = current_time + nanoseconds;
-
-  // Wait until the end time
-  while (shared_rtc_get_time() < sleep_end) {
-    asm volatile("wfi");
-  }
+  sleep_ticks(timer_ns_to_ticks(nanoseconds));
 }
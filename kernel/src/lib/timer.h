@@ -6,6 +6,16 @@
 #define MHZ(x) ((x) * 1000000)
 #define TIMER_FREQUENCY MHZ(10)
 
+#define TIMER_TICKS_PER_US (TIMER_FREQUENCY / 1000000)
+
+G_INLINE uint64_t timer_us_to_ticks(uint64_t us) {
+    return us * TIMER_TICKS_PER_US;
+}
+
+G_INLINE uint64_t timer_ns_to_ticks(uint64_t ns) {
+    return ns / (1000 / TIMER_TICKS_PER_US);
+}
+
 G_INLINE uint64_t get_csrr_time(void) {
     uint64_t t;
     asm volatile("csrr %0, time" : "=r"(t));
@@ -0,0 +1,104 @@
+#include "timer_queue.h"
+#include "lib/cpu.h"
+#include "lib/sbi.h"
+#include "lib/timer.h"
+#include <lib/panic.h>
+#include <stddef.h>
+
+#define NODE_TO_TIMER(n) ((ktimer_t *)((char *)(n) - offsetof(ktimer_t, node)))
+
+void timer_queues_init(void) {
+  for (int i = 0; i < NCPU; i++) {
+    timer_queue_t *tq = &cpus[i].timers;
+    initlock(&tq->lock, "timer_queue");
+    if (!heap_init(&tq->heap))
+      panic("timer_queues_init: out of memory");
+    tq->programmed = UINT64_MAX;
+  }
+}
+
+void ktimer_init(ktimer_t *t, ktimer_fn_t fn, void *arg) {
+  t->node.key = 0;
+  t->node.index = 0;
+  t->fn = fn;
+  t->arg = arg;
+  t->queue = NULL;
+}
+
+void timer_program(uint64_t deadline) {
+  timer_queue_t *tq = &current_cpu()->timers;
+  tq->programmed = deadline;
+  sbi_set_timer(deadline);
+}
+
+g_bool ktimer_arm(ktimer_t *t, uint64_t deadline) {
+  ktimer_cancel(t);
+
+  intr_push_off();
+  timer_queue_t *tq = &current_cpu()->timers;
+
+  acquire(&tq->lock);
+  t->node.key = deadline;
+  if (!heap_push(&tq->heap, &t->node)) {
+    release(&tq->lock);
+    intr_pop_off();
+    return false;
+  }
+  t->queue = tq;
+  release(&tq->lock);
+
+  /* only touch the hardware if this timer is now the earliest event */
+  if (deadline < tq->programmed)
+    timer_program(deadline);
+
+  intr_pop_off();
+  return true;
+}
+
+void ktimer_cancel(ktimer_t *t) {
+  timer_queue_t *tq = t->queue;
+  if (!tq)
+    return;
+
+  acquire(&tq->lock);
+  /* the timer may have fired while we were waiting for the lock */
+  if (t->queue == tq && heap_node_queued(&t->node)) {
+    heap_remove(&tq->heap, &t->node);
+    t->queue = NULL;
+  }
+  release(&tq->lock);
+}
+
+void timer_queue_run(void) {
+  timer_queue_t *tq = &current_cpu()->timers;
+  uint64_t now = get_csrr_time();
+
+  for (;;) {
+    acquire(&tq->lock);
+    heap_node_t *n = heap_peek(&tq->heap);
+    if (!n || n->key > now) {
+      release(&tq->lock);
+      break;
+    }
+    heap_remove(&tq->heap, n);
+    ktimer_t *t = NODE_TO_TIMER(n);
+    t->queue = NULL;
+    release(&tq->lock);
+
+    /* run without the queue lock, the callback may re-arm the timer */
+    t->fn(t->arg);
+  }
+}
+
+uint64_t timer_queue_next_deadline(void) {
+  timer_queue_t *tq = &current_cpu()->timers;
+  uint64_t deadline = UINT64_MAX;
+
+  acquire(&tq->lock);
+  heap_node_t *n = heap_peek(&tq->heap);
+  if (n)
+    deadline = n->key;
+  release(&tq->lock);
+
+  return deadline;
+}
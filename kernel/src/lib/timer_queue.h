@@ -0,0 +1,52 @@
+#pragma once
+/*
+ * Per-hart kernel timer queue.
+ *
+ * Each hart keeps its pending timers in a min-heap ordered by deadline (in
+ * `time` CSR ticks, see lib/timer.h) and programs sbi_set_timer for the
+ * earliest one. Expired timers run from the supervisor timer interrupt on the
+ * hart that armed them, with interrupts disabled and no locks held.
+ */
+
+#include <lib/heap.h>
+#include <lib/spinlock.h>
+#include <lib/types.h>
+#include <stdint.h>
+
+typedef void (*ktimer_fn_t)(void *arg);
+
+typedef struct ktimer {
+  heap_node_t node; /* node.key is the deadline */
+  ktimer_fn_t fn;
+  void *arg;
+  struct timer_queue *queue; /* queue holding the timer, NULL if idle */
+} ktimer_t;
+
+typedef struct timer_queue {
+  struct spinlock lock;
+  heap_t heap;
+  uint64_t programmed; /* deadline currently set with sbi_set_timer */
+} timer_queue_t;
+
+/* Initialises the timer queue of every hart. Called once at boot. */
+void timer_queues_init(void);
+
+void ktimer_init(ktimer_t *t, ktimer_fn_t fn, void *arg);
+
+/*
+ * Arms `t` to fire at `deadline` on the calling hart, re-arming it if it was
+ * already pending. Returns false if the queue could not grow.
+ */
+g_bool ktimer_arm(ktimer_t *t, uint64_t deadline);
+
+/* Disarms `t`. Does nothing if it is not pending. */
+void ktimer_cancel(ktimer_t *t);
+
+/* Runs every expired timer of the calling hart. */
+void timer_queue_run(void);
+
+/* Earliest pending deadline of the calling hart, UINT64_MAX if none. */
+uint64_t timer_queue_next_deadline(void);
+
+/* Programs the calling hart's timer interrupt for `deadline`. */
+void timer_program(uint64_t deadline);
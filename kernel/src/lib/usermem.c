@@ -6,10 +6,31 @@
 #define PAGE_OFFSET(addr) ((addr) & (PAGE_SIZE - 1))
 #define PAGE_REMAIN(addr) (PAGE_SIZE - PAGE_OFFSET(addr))
 
+/* a user proc may only reach its own pages, never the trapframe,
+   trampoline or a read-only shared page through the kernel */
+#define USER_READ (PTE_V | PTE_U | PTE_R)
+#define USER_WRITE (PTE_V | PTE_U | PTE_W)
+
 static inline uint64_t min_u64(uint64_t a, uint64_t b) {
   return (a < b) ? a : b;
 }
 
+g_bool user_writable(page_table_t *pagetable, uint64_t va, uint64_t len) {
+  if (va + len < va)
+    return false;
+
+  uint64_t end = va + len;
+  uint64_t pa;
+
+  // one lookup per page the range touches
+  for (va -= PAGE_OFFSET(va); va < end; va += PAGE_SIZE) {
+    if (!get_user_physical_address(pagetable, va, USER_WRITE, &pa))
+      return false;
+  }
+
+  return true;
+}
+
 /*
  * Copy `len` bytes from kernel buffer `src` into user-space virtual address
  * `dstva` that is translated using `pagetable`.
@@ -18,10 +39,14 @@ RESULT_TYPE(void)
 copyout(page_table_t *pagetable, uint64_t dstva, void *src, uint64_t len) {
   uint8_t *kbuf = (uint8_t *)src;
 
+  if (!user_writable(pagetable, dstva, len)) {
+    return RESULT_FAILURE(RESULT_FAULT); /* not writable user memory */
+  }
+
   while (len > 0) {
     uint64_t pa;
-    if (!get_physical_address(pagetable, dstva, &pa)) {
-      return RESULT_FAILURE(RESULT_ERROR); /* unmapped user page */
+    if (!get_user_physical_address(pagetable, dstva, USER_WRITE, &pa)) {
+      return RESULT_FAILURE(RESULT_FAULT);
     }
 
     uint64_t n = min_u64(len, PAGE_REMAIN(dstva));
@@ -47,8 +72,8 @@ copyin(page_table_t *pagetable, void *dst, uint64_t srcva, uint64_t len) {
 
   while (len > 0) {
     uint64_t pa;
-    if (!get_physical_address(pagetable, srcva, &pa)) {
-      return RESULT_FAILURE(RESULT_ERROR); /* unmapped user page */
+    if (!get_user_physical_address(pagetable, srcva, USER_READ, &pa)) {
+      return RESULT_FAILURE(RESULT_FAULT); /* not readable user memory */
     }
 
     uint64_t n = min_u64(len, PAGE_REMAIN(srcva));
@@ -1,15 +1,22 @@
 #pragma once
 
 #include <lib/result.h>
+#include <lib/types.h>
 #include <stdint.h>
 #include <page_table.h>
 
+/*
+ * True if every page of [va, va + len) is mapped writable with PTE_U in
+ * `pagetable`, i.e. copyout() to it would succeed.
+ */
+g_bool user_writable(page_table_t *pagetable, uint64_t va, uint64_t len);
+
 /*
  * Copy `len` bytes from the kernel buffer `src` into the user-space virtual
  * address `dstva`, translating through the given `pagetable`.
  *
- * Returns RESULT_OK on success or RESULT_ERROR if any portion of the destination
- * range is not mapped user memory.
+ * Returns RESULT_OK on success or RESULT_FAULT if any page of the destination
+ * range is not mapped writable with PTE_U. Nothing is copied in that case.
  */
 RESULT_TYPE(void) copyout(page_table_t *pagetable,
                           uint64_t      dstva,
@@ -20,8 +27,8 @@ RESULT_TYPE(void) copyout(page_table_t *pagetable,
  * Copy `len` bytes from the user-space virtual address `srcva` into the kernel
  * buffer `dst`, translating through the given `pagetable`.
  *
- * Returns RESULT_OK on success or RESULT_ERROR if any portion of the source
- * range is not mapped user memory.
+ * Returns RESULT_OK on success or RESULT_FAULT if any page of the source range
+ * is not mapped readable with PTE_U.
  */
 RESULT_TYPE(void) copyin(page_table_t *pagetable,
                          void         *dst,
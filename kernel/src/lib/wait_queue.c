@@ -0,0 +1,18 @@
+#include "wait_queue.h"
+
+static wait_bucket_t wait_table[WAIT_HASH_SIZE];
+
+void wait_queues_init(void) {
+  for (int i = 0; i < WAIT_HASH_SIZE; i++) {
+    initlock(&wait_table[i].lock, "wait_bucket");
+    list_init(&wait_table[i].waiters);
+  }
+}
+
+wait_bucket_t *wait_bucket(const void *chan) {
+  /* channels are mostly aligned kernel addresses, drop the low bits and
+     spread the rest with a multiplicative (Fibonacci) hash */
+  uint64_t key = (uint64_t)chan >> 3;
+  key *= 0x9E3779B97F4A7C15ULL;
+  return &wait_table[key >> (64 - WAIT_HASH_BITS)];
+}
@@ -0,0 +1,26 @@
+#pragma once
+/*
+ * Hashed wait channels for sleep()/wakeup().
+ *
+ * A sleeping proc is linked into the bucket its channel address hashes to,
+ * so wakeup(chan) only walks the procs waiting on channels in that bucket
+ * instead of every proc in the system.
+ */
+
+#include <lib/list.h>
+#include <lib/spinlock.h>
+#include <stdint.h>
+
+#define WAIT_HASH_BITS 6
+#define WAIT_HASH_SIZE (1 << WAIT_HASH_BITS)
+
+typedef struct wait_bucket {
+  struct spinlock lock;
+  list_node_t waiters; /* procs sleeping on channels that hash here */
+} wait_bucket_t;
+
+/* Initialises every bucket. Called once at boot. */
+void wait_queues_init(void);
+
+/* Returns the bucket for `chan`. */
+wait_bucket_t *wait_bucket(const void *chan);
@@ -1,15 +1,23 @@
+#include "bench.h"
 #include "buddy_allocator.h"
 #include "kprocs/cursor_daemon.h"
 #include "kprocs/wallpaper_daemon.h"
 #include "lib/canary.h"
+#include "lib/deferred.h"
 #include "lib/dyn_array.h"
+#include "lib/intr_trace.h"
 #include "lib/kalloc.h"
 #include "lib/macros.h"
 #include "lib/sbi.h"
 #include "lib/timer.h"
+#include "lib/timer_queue.h"
 #include "mem_layout.h"
 #include "platform/interrupts.h"
+#include "irq.h"
 #include "proc.h"
+#include "serial.h"
+#include "trap_handler.h"
+#include "vdso.h"
 #include <device/console.h>
 #include <device/framebuffer.h>
 #include <device/plic.h>
@@ -32,15 +40,17 @@
 #include <physical_alloc.h>
 #include <platform/registers.h>
 #include <stdbool.h>
+#include <tests/futex_test.h>
+#include <tests/io_ring_test.h>
+#include <tests/mailbox_test.h>
+#include <tests/proc_test.h>
+#include <tests/sched_test.h>
 #include <tests/trap_test.h>
 
 #define VERSION "0.0.1"
 
 // #define TESTS
 
-extern void trap_vector();
-extern char trap_stack_top; /* provided by trap.s */
-
 extern char kstart[]; // kernel start
                       // defined by linker script.
 
@@ -54,14 +64,19 @@ void enable_interrupts() {
   PS_enable_all_interrupt_types();
 }
 
+/* PLIC sources of the QEMU virt devices */
+#define VIRTIO_KEYBOARD_IRQ 1
+#define VIRTIO_MOUSE_IRQ 2
+#define UART_IRQ 10
+
+static void keyboard_irq(void *ctx) { virtio_keyboard_handle_irq(ctx); }
+static void mouse_irq(void *ctx) { virtio_mouse_handle_irq(ctx); }
+
 G_INLINE void init_trap_vector(void) {
-  /* point stvec at trap_vector */
-  uintptr_t base = ((uintptr_t)&trap_vector) & ~0x3UL;
-  PS_set_trap_vector(base);
+  trap_init();
 
-  /* and preload sscratch with &trap_stack_top so the vector can
-     switch to it immediately. */
-  asm volatile("csrw sscratch, %0" ::"r"(&trap_stack_top));
+  /* point stvec at the kernel vectors, see trap.s */
+  PS_set_trap_vector(kernel_trap_vector());
 }
 
 extern uint8_t proc_ecall7_start[];
@@ -82,6 +97,7 @@ void main() {
 
   sbi_set_timer(UINT64_MAX);
   init_trap_vector();
+  fpu_init();
   // sbi_set_timer(UINT64_MAX); // Disable timer interrupts initially
 
 // canary_dbg_val((uint64_t)initialize_pages);
@@ -218,6 +234,7 @@ void main() {
     panic("Failed to initialize RTC");
   }
   set_shared_rtc(rtc);
+  vdso_init();
   result_t rplic = make_plic(0x0C000000);
   plic_t *plic = (plic_t *)result_unwrap(rplic);
   if (!plic_init(plic)) {
@@ -237,16 +254,13 @@ void main() {
   }
   set_shared_cursor(cursor);
 
-  // uart interrupt
-  plic_set_priority(plic, 10, 1);
-  plic_set_threshold(plic, 0, PLIC_CONTEXT_SUPERVISOR, 0);
-  plic_enable_interrupt(plic, 0, PLIC_CONTEXT_SUPERVISOR, 10);
+  plic_set_threshold(plic, IRQ_HART, PLIC_CONTEXT_SUPERVISOR, 0);
 
-  // enable virtio keyboard interrupt
-  plic_set_priority(plic, 1, 1);
-  plic_enable_interrupt(plic, 0, PLIC_CONTEXT_SUPERVISOR, 1);
+  if (!result_is_ok(irq_register(UART_IRQ, serial_handle_irq, uart, IRQ_PRIORITY(1)))) {
+    panic("Failed to register UART interrupt");
+  }
 
-  result_t rkbd = make_virtio_keyboard(0x10001000, 1);
+  result_t rkbd = make_virtio_keyboard(0x10001000, VIRTIO_KEYBOARD_IRQ);
   if (!result_is_ok(rkbd)) {
     panic("Failed to create virtio keyboard");
   }
@@ -255,14 +269,14 @@ void main() {
     panic("Failed to initialize virtio keyboard");
   }
   set_shared_virtio_keyboard(kbd);
+  if (!result_is_ok(
+          irq_register(VIRTIO_KEYBOARD_IRQ, keyboard_irq, kbd, IRQ_PRIORITY(1)))) {
+    panic("Failed to register virtio keyboard interrupt");
+  }
 
   print_memory_map();
 
-  // enable virtio mouse interrupt
-  plic_set_priority(plic, 2, 1);
-  plic_enable_interrupt(plic, 0, PLIC_CONTEXT_SUPERVISOR, 2);
-
-  result_t rmouse = make_virtio_mouse(0x10002000, 2);
+  result_t rmouse = make_virtio_mouse(0x10002000, VIRTIO_MOUSE_IRQ);
   if (!result_is_ok(rmouse)) {
     panic("Failed to create virtio mouse");
   }
@@ -271,10 +285,10 @@ void main() {
     panic("Failed to initialize virtio mouse");
   }
   set_shared_virtio_mouse(mouse);
-
-  // enable virtio gpu interrup
-  // plic_set_priority(plic, 3, 1);
-  // plic_enable_interrupt(plic, 0, PLIC_CONTEXT_SUPERVISOR, 3);
+  if (!result_is_ok(
+          irq_register(VIRTIO_MOUSE_IRQ, mouse_irq, mouse, IRQ_PRIORITY(1)))) {
+    panic("Failed to register virtio mouse interrupt");
+  }
 
   // result_t rgpu = make_virtio_gpu(0x10003000, 3);
   // if (!result_is_ok(rgpu)) {
@@ -326,6 +340,41 @@ void main() {
   //        (uint64_t)kt);
 
   initialize_processes();
+  timer_queues_init();
+
+#ifdef TESTS
+  if (!run_sched_tests()) {
+    panic("Scheduler tests failed");
+  } else {
+    print("Scheduler tests passed\n", PRINT_FLAG_BOTH);
+  }
+
+  if (!run_proc_tests()) {
+    panic("Process tests failed");
+  } else {
+    print("Process tests passed\n", PRINT_FLAG_BOTH);
+  }
+
+  if (!run_io_ring_tests()) {
+    panic("io_ring tests failed");
+  } else {
+    print("io_ring tests passed\n", PRINT_FLAG_BOTH);
+  }
+
+  if (!run_futex_tests()) {
+    panic("futex tests failed");
+  } else {
+    print("futex tests passed\n", PRINT_FLAG_BOTH);
+  }
+
+  if (!start_futex_wait_tests()) {
+    panic("Failed to start futex wait tests");
+  }
+
+  if (!start_mailbox_tests()) {
+    panic("Failed to start mailbox tests");
+  }
+#endif
 
   printf("(uint64_t)trampoline = %{type: hex}\n", PRINT_FLAG_BOTH,
          (uint64_t)trampoline);
@@ -342,26 +391,40 @@ void main() {
       (uint64_t)proc_ecall8_end - (uint64_t)proc_ecall8_start;
   proc_from_code(proc_ecall8_start, size_ecall8, "e8");
 
+  user_bench_start();
+
   printf("Creating kernel tasks...\n", PRINT_FLAG_BOTH);
 
-  result_t rcursor_task = make_kernel_task(cursor_daemon, NULL, "cursord");
+  kernel_task_opts_t cursor_opts = {
+      .priority = PROC_PRIORITY_HIGH,
+      .period_us = CURSOR_DAEMON_PERIOD_US,
+      .budget_us = CURSOR_DAEMON_BUDGET_US,
+  };
+  result_t rcursor_task =
+      make_kernel_task_opts(cursor_daemon, NULL, "cursord", &cursor_opts);
   if (result_is_ok(rcursor_task)) {
     printf("Created cursord task\n", PRINT_FLAG_BOTH);
   } else {
     printf("Failed to create cursord task\n", PRINT_FLAG_BOTH);
   }
 
-  result_t rwallpaper_task =
-      make_kernel_task(wallpaper_daemon, NULL, "wallpaperd");
+  kernel_task_opts_t wallpaper_opts = {
+      .priority = PROC_PRIORITY_HIGH,
+      .period_us = WALLPAPER_DAEMON_PERIOD_US,
+      .budget_us = WALLPAPER_DAEMON_BUDGET_US,
+  };
+  result_t rwallpaper_task = make_kernel_task_opts(
+      wallpaper_daemon, NULL, "wallpaperd", &wallpaper_opts);
   if (result_is_ok(rwallpaper_task)) {
     printf("Created wallpaperd task\n", PRINT_FLAG_BOTH);
   } else {
     printf("Failed to create wallpaperd task\n", PRINT_FLAG_BOTH);
   }
 
-  printf("Started kernel daemons with priority scheduling\n", PRINT_FLAG_BOTH);
+  deferred_init();
+  intr_trace_init();
 
-  sbi_set_timer(get_csrr_time() + 1000000);
+  printf("Started kernel daemons with priority scheduling\n", PRINT_FLAG_BOTH);
 
   scheduler();
 
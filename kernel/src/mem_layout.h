@@ -3,5 +3,22 @@
 #define RAM_START 0x80000000
 #define MAXVA (1L << (9 + 9 + 9 + 12 - 1))
 #define TRAMPOLINE (MAXVA - 4096)
-#define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*4096)
+
+/* kernel stack size in pages, can be overridden from the build flags */
+#ifndef KSTACK_PAGES
+#define KSTACK_PAGES 2
+#endif
+#define KSTACK_SIZE (KSTACK_PAGES * 4096)
+
+/* kernel stack slots grow down from TRAMPOLINE, each one has an unmapped
+   guard page below it */
+#define KSTACK(slot) (TRAMPOLINE - ((slot) + 1) * (KSTACK_PAGES + 1) * 4096)
 #define TRAPFRAME (TRAMPOLINE - 4096)
+
+/* io_ring shared pages in a user address space, see io_ring.h */
+#define IO_RING_PAGES 2
+#define IO_RING_BASE (TRAPFRAME - IO_RING_PAGES * 4096)
+
+/* vDSO clock page and its code in a user address space, see vdso.h */
+#define VDSO_DATA (IO_RING_BASE - 4096)
+#define VDSO_TEXT (VDSO_DATA - 4096)
@@ -90,6 +90,27 @@ bool map_page(page_table_t *root_table, uint64_t virtual_address,
   return false;
 }
 
+static void free_table_level(page_table_t *table, int level) {
+  if (level > 0) {
+    for (int i = 0; i < 512; i++) {
+      pte_t entry = table->entries[i];
+      // a valid entry without R/W/X points to the next level
+      if ((entry & PTE_V) && !(entry & (PTE_R | PTE_W | PTE_X)))
+        free_table_level((page_table_t *)pa_to_va((entry >> 10) << 12),
+                         level - 1);
+    }
+  }
+
+  free_page(table);
+}
+
+void free_page_table(page_table_t *root_table) {
+  if (!root_table)
+    return;
+
+  free_table_level(root_table, SV39_LEVELS - 1);
+}
+
 bool unmap_page(page_table_t *root_table, uint64_t virtual_address) {
   if (!root_table) {
     return false;
@@ -121,12 +142,13 @@ bool unmap_page(page_table_t *root_table, uint64_t virtual_address) {
   return false;
 }
 
-bool get_physical_address(page_table_t *root_table, uint64_t virtual_address,
-                          uint64_t *physical_address) {
-  if (!root_table || !physical_address) {
-    return false;
-  }
-
+/**
+ * @brief Find the leaf entry mapping a virtual address.
+ * @param root_table Pointer to the root page table.
+ * @param virtual_address The virtual address to look up.
+ * @return The leaf entry, or 0 if the address is not mapped.
+ */
+static pte_t leaf_entry(page_table_t *root_table, uint64_t virtual_address) {
   uint16_t vpn[SV39_LEVELS];
   get_vpn_indices(virtual_address, vpn);
 
@@ -137,14 +159,11 @@ bool get_physical_address(page_table_t *root_table, uint64_t virtual_address,
     pte_t entry = current_table->entries[index];
 
     if (!(entry & PTE_V)) {
-      return false; // Entry not valid
+      return 0; // Entry not valid
     }
 
     if ((entry & (PTE_R | PTE_W | PTE_X)) != 0) {
-      uint64_t ppn = entry >> 10;
-      uint64_t offset = virtual_address & 0xFFF;
-      *physical_address = (ppn << 12) | offset;
-      return true;
+      return entry;
     }
 
     uint64_t next_table_pa = (entry >> 10) << 12;
@@ -152,7 +171,31 @@ bool get_physical_address(page_table_t *root_table, uint64_t virtual_address,
     current_table = (page_table_t *)next_table_va;
   }
 
-  return false;
+  return 0;
+}
+
+bool get_physical_address(page_table_t *root_table, uint64_t virtual_address,
+                          uint64_t *physical_address) {
+  return get_user_physical_address(root_table, virtual_address, PTE_V,
+                                   physical_address);
+}
+
+bool get_user_physical_address(page_table_t *root_table,
+                               uint64_t virtual_address, uint64_t flags,
+                               uint64_t *physical_address) {
+  if (!root_table || !physical_address) {
+    return false;
+  }
+
+  pte_t entry = leaf_entry(root_table, virtual_address);
+  if (!entry || (entry & flags) != flags) {
+    return false;
+  }
+
+  uint64_t ppn = entry >> 10;
+  uint64_t offset = virtual_address & 0xFFF;
+  *physical_address = (ppn << 12) | offset;
+  return true;
 }
 
 bool identity_map(page_table_t *root_table, uint64_t start_address,
@@ -74,6 +74,13 @@ bool map_page(page_table_t *root_table, uint64_t virtual_address,
  */
 bool unmap_page(page_table_t *root_table, uint64_t virtual_address);
 
+/**
+ * @brief Free a page table and every intermediate table below it. The pages
+ * mapped by its leaf entries are not freed.
+ * @param root_table Pointer to the root page table.
+ */
+void free_page_table(page_table_t *root_table);
+
 /**
  * @brief Look up the physical address mapped to a virtual address.
  * @param root_table Pointer to the root page table.
@@ -84,6 +91,20 @@ bool unmap_page(page_table_t *root_table, uint64_t virtual_address);
 bool get_physical_address(page_table_t *root_table, uint64_t virtual_address,
                           uint64_t *physical_address);
 
+/**
+ * @brief Like get_physical_address(), but only succeeds if the leaf entry has
+ * every bit in `flags` set. Pass PTE_U plus the access to be made before
+ * touching memory on behalf of a user proc.
+ * @param root_table Pointer to the root page table.
+ * @param virtual_address The virtual address to look up.
+ * @param flags PTE_* bits the mapping must have.
+ * @param physical_address Output parameter for the physical address.
+ * @return `true` if a mapping with `flags` exists, `false` otherwise.
+ */
+bool get_user_physical_address(page_table_t *root_table,
+                               uint64_t virtual_address, uint64_t flags,
+                               uint64_t *physical_address);
+
 /**
  * @brief Set up an identity mapping for a range of addresses.
  * This is useful for early boot stages where the kernel needs to access
@@ -0,0 +1,94 @@
+#include "pid.h"
+#include "proc.h"
+
+#define PID_WORDS (PID_MAX / 64)
+
+typedef struct pid_bucket {
+  struct spinlock lock;
+  list_node_t procs;
+} pid_bucket_t;
+
+static uint64_t pid_bitmap[PID_WORDS];
+static uint64_t pid_cursor; /* next PID to try, only ever grows */
+static pid_bucket_t pid_table[PID_HASH_SIZE];
+
+void pid_init(void) {
+  for (int i = 0; i < PID_WORDS; i++)
+    pid_bitmap[i] = 0;
+  pid_bitmap[0] = 1; /* PID 0 means "self" */
+  pid_cursor = 1;
+
+  for (int i = 0; i < PID_HASH_SIZE; i++) {
+    initlock(&pid_table[i].lock, "pid_bucket");
+    list_init(&pid_table[i].procs);
+  }
+}
+
+int pid_alloc(void) {
+  // every hart starts at its own cursor value, so they rarely race for the
+  // same word
+  uint64_t start = __atomic_fetch_add(&pid_cursor, 1, __ATOMIC_RELAXED);
+
+  for (uint64_t n = 0; n < PID_MAX; n++) {
+    int pid = (start + n) % PID_MAX;
+    uint64_t bit = 1UL << (pid % 64);
+
+    if (__atomic_load_n(&pid_bitmap[pid / 64], __ATOMIC_RELAXED) & bit)
+      continue;
+    if (!(__atomic_fetch_or(&pid_bitmap[pid / 64], bit, __ATOMIC_ACQUIRE) &
+          bit)) {
+      // skip the cursor past whatever we had to search through
+      if (n)
+        __atomic_fetch_add(&pid_cursor, n, __ATOMIC_RELAXED);
+      return pid;
+    }
+  }
+
+  return -1;
+}
+
+void pid_free(int pid) {
+  if (pid <= 0 || pid >= PID_MAX)
+    return;
+
+  __atomic_fetch_and(&pid_bitmap[pid / 64], ~(1UL << (pid % 64)),
+                     __ATOMIC_RELEASE);
+}
+
+static pid_bucket_t *pid_bucket(int pid) {
+  return &pid_table[pid & (PID_HASH_SIZE - 1)];
+}
+
+void pid_hash_insert(proc_t *p) {
+  pid_bucket_t *b = pid_bucket(p->pid);
+
+  acquire(&b->lock);
+  list_push_back(&b->procs, &p->pid_node);
+  release(&b->lock);
+}
+
+void pid_hash_remove(proc_t *p) {
+  pid_bucket_t *b = pid_bucket(p->pid);
+
+  acquire(&b->lock);
+  if (list_linked(&p->pid_node))
+    list_remove(&p->pid_node);
+  release(&b->lock);
+}
+
+proc_t *pid_hash_find(int pid) {
+  pid_bucket_t *b = pid_bucket(pid);
+  proc_t *found = NULL;
+
+  acquire(&b->lock);
+  LIST_FOR_EACH(it, &b->procs) {
+    proc_t *p = LIST_ENTRY(it, proc_t, pid_node);
+    if (p->pid == pid) {
+      found = p;
+      break;
+    }
+  }
+  release(&b->lock);
+
+  return found;
+}
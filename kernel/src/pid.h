@@ -0,0 +1,45 @@
+#pragma once
+/*
+ * PID allocation and the PID-to-proc index.
+ *
+ * PIDs come from a bitmap claimed with atomic bit operations, so harts
+ * creating procs at the same time never serialise on a lock. A rotating
+ * cursor hands out numbers in increasing order and only wraps around to
+ * reuse freed ones once it reaches PID_MAX. PID 0 is never allocated; the
+ * syscalls use it to mean the caller.
+ *
+ * Live procs are hashed by PID so kill() and friends find them without
+ * walking the process table.
+ */
+
+#include <lib/list.h>
+#include <lib/spinlock.h>
+#include <lib/types.h>
+
+#define PID_MAX 32768
+
+#define PID_HASH_BITS 6
+#define PID_HASH_SIZE (1 << PID_HASH_BITS)
+
+typedef struct proc proc_t;
+
+/* Initialises the bitmap and the hash. Called once at boot. */
+void pid_init(void);
+
+/* Returns a free PID, or -1 if all PID_MAX - 1 are taken. */
+int pid_alloc(void);
+void pid_free(int pid);
+
+/*
+ * Adds `p` to / removes it from the index under p->pid. The caller holds
+ * p->lock.
+ */
+void pid_hash_insert(proc_t *p);
+void pid_hash_remove(proc_t *p);
+
+/*
+ * Returns the proc indexed under `pid`, or NULL. No lock is held on return:
+ * the caller takes p->lock and checks p->pid again, since proc_t memory is
+ * never freed but may have been reused meanwhile.
+ */
+proc_t *pid_hash_find(int pid);
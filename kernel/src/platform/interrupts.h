@@ -10,11 +10,28 @@
 #define SSTATUS_UIE (1L << 0)  // User Interrupt Enable
 #define SSTATUS_SUM   (1L << 18) // Supervisor User Memory Access
 
+// FS (floating point) and VS (vector) context status fields of sstatus
+#define SSTATUS_FS (3L << 13)
+#define SSTATUS_FS_OFF (0L << 13)
+#define SSTATUS_FS_INITIAL (1L << 13)
+#define SSTATUS_FS_CLEAN (2L << 13)
+#define SSTATUS_FS_DIRTY (3L << 13)
+#define SSTATUS_VS (3L << 9)
+#define SSTATUS_VS_OFF (0L << 9)
+#define SSTATUS_VS_INITIAL (1L << 9)
+#define SSTATUS_VS_CLEAN (2L << 9)
+#define SSTATUS_VS_DIRTY (3L << 9)
+
 #define SIE_EXTERNAL (1 << 9) // External interrupt enable bit in sie register
 #define SIE_TIMER (1 << 5)   // Timer interrupt enable bit in sie register
 #define SIE_SOFTWARE (1 << 1) // Software interrupt enable bit in sie register
 #define SIE_ALL (SIE_EXTERNAL | SIE_TIMER | SIE_SOFTWARE) // All interrupt enable bits
 
+// stvec MODE field: direct sends every trap to BASE, vectored sends
+// interrupt N to BASE + 4 * N
+#define STVEC_MODE_DIRECT 0UL
+#define STVEC_MODE_VECTORED 1UL
+
 
 
 G_INLINE void PS_enable_interrupts(void) {
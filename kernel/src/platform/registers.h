@@ -29,6 +29,16 @@ G_INLINE void PS_set_interrupt_enable(uint64_t ie) {
     asm volatile("csrw sie, %0" : : "r"(ie));
 }
 
+G_INLINE uint64_t PS_get_interrupt_pending() {
+    uint64_t ip;
+    asm volatile("csrr %0, sip" : "=r"(ip));
+    return ip;
+}
+
+G_INLINE void PS_clear_interrupt_pending(uint64_t ip) {
+    asm volatile("csrc sip, %0" : : "r"(ip));
+}
+
 G_INLINE uint64_t P_get_thread_ptr() {
     uint64_t ptr;
     asm volatile("mv %0, tp" : "=r"(ptr));
@@ -80,3 +90,11 @@ G_INLINE uint64_t PS_get_exception_value() {
     asm volatile("csrr %0, stval" : "=r"(value));
     return value;
 }
+
+/* scounteren bits: counters U-mode may read without trapping */
+#define SCOUNTEREN_CY (1 << 0)
+#define SCOUNTEREN_TM (1 << 1)
+
+G_INLINE void PS_enable_user_counters(uint64_t counters) {
+    asm volatile("csrs scounteren, %0" : : "r"(counters));
+}
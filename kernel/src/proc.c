@@ -2,16 +2,28 @@
 #include "lib/ansi.h"
 #include "lib/context.h"
 #include "lib/cpu.h"
+#include "lib/deferred.h"
 #include "lib/gfx.h"
 #include "lib/gizm_font.h"
 #include "lib/print.h"
 #include "lib/result.h"
+#include "lib/slab.h"
 #include "lib/spinlock.h"
 #include "lib/str.h"
+#include "lib/timer.h"
 #include "lib/usermem.h"
+#include "lib/wait_queue.h"
+#include "io_ring.h"
 #include "limine_requests.h"
+#include "pid.h"
 #include "platform/interrupts.h"
 #include "platform/registers.h"
+#include "sched.h"
+#include "serial.h"
+#include "syscall.h"
+#include "trap_handler.h"
+#include "trap_stats.h"
+#include "vdso.h"
 
 #include <lib/memory.h>
 #include <lib/panic.h>
@@ -23,10 +35,30 @@
 
 // #define DBG
 
-proc_t proc[NPROC];
-
-uint64_t pid = 0;
-struct spinlock pid_lock;
+/*
+ * Process table. proc_t structures come from a slab cache and are never
+ * freed: an UNUSED proc goes on free_procs and is reused by the next
+ * make_proc(), so all_procs only grows to the peak number of procs.
+ *
+ * An UNUSED proc may still hold its shell: the mapped kernel stack, the
+ * trapframe and a root page table with TRAMPOLINE and TRAPFRAME mapped. Those
+ * are reset rather than rebuilt on reuse. Procs with a shell sit at the front
+ * of free_procs so they are reused first. The mailbox is never freed, like
+ * the proc_t, so proc_send() can post to a proc that exits meanwhile.
+ *
+ * Procs are found by PID through the hash in pid.c, and a parent finds its
+ * children through its own children list, so neither walks all_procs.
+ *
+ * Lock order is wait_lock, proc_table_lock, p->lock, then proc_free_lock or
+ * a PID hash bucket.
+ */
+static slab_cache_t proc_cache;
+static struct spinlock proc_table_lock; /* all_procs, next_kstack_slot */
+static list_node_t all_procs;
+static uint64_t next_kstack_slot;
+static struct spinlock proc_free_lock; /* free_procs, idle_shells */
+static list_node_t free_procs;
+static uint64_t idle_shells; /* UNUSED procs that kept their shell */
 
 struct spinlock wait_lock;
 
@@ -34,8 +66,6 @@ extern char trampoline[];
 extern char uservec[];
 extern char userret[];
 
-extern void trap_vector();
-
 extern void swtch(context_t *, context_t *);
 
 proc_t *init_proc;
@@ -44,6 +74,7 @@ proc_t *init_proc;
 #define PGROUNDDOWN(sz) ((sz) & ~(PAGE_SIZE - 1))
 
 g_bool uvmdealloc(proc_t *p, uint64_t oldsz, uint64_t newsz); /* fwd */
+static void finish_handoff(void);                              /* fwd */
 
 /* grow from oldsz up to newsz (page-aligned) */
 g_bool uvmalloc(proc_t *p, uint64_t oldsz, uint64_t newsz) {
@@ -105,58 +136,52 @@ g_bool uvmcopy(page_table_t *src, page_table_t *dst, uint64_t sz) {
   return true;
 }
 
-g_bool setup_process_kernel_stack(proc_t *p, uint8_t pidx) {
-  if (!p)
-    return false;
-
-  if (!p->kstack) {
-
-    void *kstack = alloc_page();
-
-    uint64_t kstackpaddr = V2P((uint64_t)kstack);
-    uint64_t kstackvaddr = KSTACK(pidx);
-
-#ifdef DBG
+static void kstack_unmap(uint64_t base, int pages) {
+  for (int i = 0; i < pages; i++) {
+    uint64_t va = base + i * PAGE_SIZE;
+    uint64_t pa = 0;
+    if (!get_physical_address(shared_page_table, va, &pa))
+      continue;
+    unmap_page(shared_page_table, va);
+    asm volatile("sfence.vma %0, zero" ::"r"(va) : "memory");
+    free_page((void *)(pa + hhdm_offset));
+  }
+}
 
-    printf("%{type: int}: %{type: hex} -> %{type: hex}\n", PRINT_FLAG_BOTH,
-           pidx, kstackvaddr, kstackpaddr);
+/* maps KSTACK_PAGES fresh pages at the proc's stack slot */
+static g_bool kstack_alloc(proc_t *p) {
+  uint64_t base = KSTACK(p->kstack_slot);
 
-#endif
+  if (p->kstack)
+    return true;
 
-    if (!map_page(shared_page_table, kstackvaddr, kstackpaddr,
-                  PTE_R | PTE_W | PTE_X | PTE_V)) {
-      panic_msg("Kernel stack mapping failed");
-      printf("pidx: %{type: int}", PRINT_FLAG_BOTH, pidx);
-      panic_loc("setup_process_kernel_stack");
+  for (int i = 0; i < KSTACK_PAGES; i++) {
+    void *page = alloc_page();
+    if (!page) {
+      kstack_unmap(base, i);
+      return false;
     }
 
-    p->kstack = kstackvaddr;
-
-    // // set first byte of kstack to 0xAA
-    // *(uint8_t *)kstack = 0xAA;
-
-    // // read from kstackvaddr to verify
-    // uint8_t *kstack_check = (uint8_t *)kstackvaddr;
-    // if (*kstack_check != 0xAA) {
-    //   panic_msg("Kernel stack verification failed");
-    //   printf("pidx: %{type: int}", PRINT_FLAG_BOTH, pidx);
-    //   panic_loc("setup_process_kernel_stack");
-    // }
-
-    // // keep reading downwards from kstackvaddr to check if the gaurd page
-    // is
-    // // working
-    // for (int i = 1; i < 0xFFFF; i++) {
-    //   volatile uint8_t *addr = (uint8_t *)(kstackvaddr - i);
-    //   volatile uint8_t val = *addr; // <-- Add this line to force the read
-    //   (void)val;                    // Prevent unused variable warning if
-    //   needed
-    // }
+    if (!map_page(shared_page_table, base + i * PAGE_SIZE,
+                  V2P((uint64_t)page), PTE_R | PTE_W | PTE_V)) {
+      free_page(page);
+      kstack_unmap(base, i);
+      return false;
+    }
   }
 
+  p->kstack = base;
   return true;
 }
 
+static void kstack_free(proc_t *p) {
+  if (!p->kstack)
+    return;
+
+  kstack_unmap(p->kstack, KSTACK_PAGES);
+  p->kstack = 0;
+}
+
 // forward declaration
 void usertrap(void);
 
@@ -174,7 +199,7 @@ void user_trap_ret(void) {
   //        (uint64_t)p->trapframe->epc);
 
   if (p->is_kernel) {
-    PS_set_trap_vector((uint64_t)trap_vector);
+    PS_set_trap_vector(kernel_trap_vector());
     PS_enable_interrupts();
     return; // run task code
   }
@@ -187,7 +212,7 @@ void user_trap_ret(void) {
   //        trampoline_uservec);
 
   p->trapframe->kernel_satp = PS_get_atp();
-  p->trapframe->kernel_sp = p->kstack + PAGE_SIZE;
+  p->trapframe->kernel_sp = p->kstack + KSTACK_SIZE;
   p->trapframe->kernel_trap = (uint64_t)usertrap;
   p->trapframe->kernel_hartid = P_get_thread_ptr();
 
@@ -197,6 +222,7 @@ void user_trap_ret(void) {
   uint64_t x = PS_get_status();
   x &= ~SSTATUS_SPP;
   x |= SSTATUS_SPIE;
+  x = fpu_user_status(p, x);
   PS_set_status(x);
 
   PS_set_exception_pc(p->trapframe->epc);
@@ -220,31 +246,23 @@ void user_trap_ret(void) {
 }
 
 void forkret() {
+  finish_handoff();
   release(&current_proc()->lock);
   user_trap_ret();
 }
 
 g_bool initialize_processes() {
-  for (uint8_t i = 0; i < NPROC; i++) {
-    proc_t *p = &proc[i];
-    initlock(&p->lock, "proc");
-    p->state = UNUSED;
-    setup_process_kernel_stack(p, i);
-  }
-
-  // lock init
-  initlock(&pid_lock, "pid_lock");
-}
-
-uint64_t allocate_pid() {
-  uint64_t new_pid = 0;
-
-  acquire(&pid_lock);
-  new_pid = pid;
-  pid++;
-  release(&pid_lock);
-
-  return new_pid;
+  slab_cache_init(&proc_cache, "proc_cache", sizeof(proc_t));
+  initlock(&proc_table_lock, "proc_table");
+  list_init(&all_procs);
+  next_kstack_slot = 0;
+  initlock(&proc_free_lock, "proc_free");
+  list_init(&free_procs);
+  idle_shells = 0;
+
+  sched_init();
+  wait_queues_init();
+  pid_init();
 }
 
 page_table_t *allocate_process_page_table(proc_t *p) {
@@ -258,80 +276,140 @@ page_table_t *allocate_process_page_table(proc_t *p) {
 
   if (!map_page(pt, TRAMPOLINE, V2P((uint64_t)trampoline),
                 PTE_R | PTE_W | PTE_X | PTE_V)) {
-    free_page(pt);
+    free_page_table(pt);
     return NULL;
   }
 
   if (!map_page(pt, TRAPFRAME, V2P((uint64_t)p->trapframe),
                 PTE_R | PTE_W | PTE_X | PTE_V)) {
-    free_page(pt);
+    free_page_table(pt);
+    return NULL;
+  }
+
+  if (!vdso_map(pt)) {
+    free_page_table(pt);
     return NULL;
   }
 
   return pt;
 }
 
-RESULT_TYPE(proc_t *) make_proc() {
+/*
+ * Builds the parts of the shell `p` does not have yet and resets the ones a
+ * previous user left behind.
+ */
+static g_bool shell_prepare(proc_t *p) {
+  if (!p->trapframe) {
+    p->trapframe = alloc_page();
+    if (!p->trapframe)
+      return false;
+  }
+  memset(p->trapframe, 0, sizeof(struct trapframe));
+
+  if (!p->shell_pagetable) {
+    p->shell_pagetable = allocate_process_page_table(p);
+    if (!p->shell_pagetable)
+      return false;
+  }
+
+  if (p->mailbox) {
+    mailbox_reset(p->mailbox);
+  } else {
+    result_t rmb = make_mailbox();
+    if (!result_is_ok(rmb))
+      return false;
+    p->mailbox = (mailbox_t *)result_unwrap(rmb);
+  }
+
+  return true;
+}
+
+/* frees whatever part of the shell `p` has */
+static void shell_destroy(proc_t *p) {
+  free_page_table(p->shell_pagetable);
+  p->shell_pagetable = NULL;
+
+  if (p->trapframe) {
+    free_page(p->trapframe);
+    p->trapframe = NULL;
+  }
+
+  kstack_free(p);
+}
+
+/* an UNUSED proc_t, recycled if possible. Its lock is not held. */
+static proc_t *proc_alloc(void) {
   proc_t *p = NULL;
 
-  for (uint8_t i = 0; i < NPROC; i++) {
-    p = &proc[i];
-    acquire(&p->lock);
-    if (p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  acquire(&proc_free_lock);
+  if (!list_empty(&free_procs)) {
+    p = LIST_ENTRY(free_procs.next, proc_t, free_node);
+    list_remove(&p->free_node);
+    if (p->kstack)
+      idle_shells--;
   }
+  release(&proc_free_lock);
 
-  return RESULT_FAILURE(RESULT_BUSY);
+  if (p)
+    return p;
 
-found:
+  p = slab_alloc(&proc_cache);
+  if (!p)
+    return NULL;
 
-  p->pid = allocate_pid();
-  p->state = USED;
-  p->priority = PROC_PRIORITY_NORMAL;
+  memset(p, 0, sizeof(proc_t));
+  initlock(&p->lock, "proc");
+  list_init(&p->children);
+  p->state = UNUSED;
 
-  // trapframe
-  struct trapframe *tf = alloc_page();
-  if (!tf) {
-    // TODO: free proc
-    release(&p->lock);
+  acquire(&proc_table_lock);
+  p->kstack_slot = next_kstack_slot++;
+  list_push_back(&all_procs, &p->table_node);
+  release(&proc_table_lock);
+
+  return p;
+}
+
+RESULT_TYPE(proc_t *) make_proc() {
+  proc_t *p = proc_alloc();
+  if (!p)
     return RESULT_FAILURE(RESULT_NOMEM);
-  }
 
-  p->trapframe = tf;
+  acquire(&p->lock);
+
+  p->pid = pid_alloc();
+  if (p->pid < 0) {
+    free_process(p);
+    release(&p->lock);
+    return RESULT_FAILURE(RESULT_BUSY);
+  }
+  pid_hash_insert(p);
 
-  // page table
-  page_table_t *pt = allocate_process_page_table(p);
-  if (!pt) {
-    free_page(p->trapframe);
-    p->trapframe = NULL;
+  p->state = USED;
+  p->priority = PROC_PRIORITY_NORMAL;
+  p->cpu = -1;
+  p->vruntime = 0;
+  p->periodic.period = 0;
+  p->periodic.remaining = 0;
+  p->last_migration = 0;
+  p->migrations = 0;
+  p->affinity = SCHED_AFFINITY_ALL;
+  memset(&p->traps, 0, sizeof(p->traps));
+  fpu_state_init(&p->fpu);
+
+  if (!kstack_alloc(p) || !shell_prepare(p)) {
+    free_process(p);
     release(&p->lock);
     return RESULT_FAILURE(RESULT_NOMEM);
   }
 
-  p->pagetable = pt;
+  p->pagetable = p->shell_pagetable;
 
   // zero out context
   memset(&p->context, 0, sizeof(context_t));
 
   p->context.ra = (uint64_t)forkret;
-  p->context.sp = p->kstack + PAGE_SIZE;
-
-  printf("alloc proc kstack = %{type: hex}\n", PRINT_FLAG_BOTH, p->kstack);
-
-  // setup mailbox
-  result_t rmb = make_mailbox();
-  if (!result_is_ok(rmb)) {
-    free_page(p->trapframe);
-    p->trapframe = NULL;
-    free_page(p->pagetable);
-    p->pagetable = NULL;
-    release(&p->lock);
-    return RESULT_FAILURE(RESULT_NOMEM);
-  }
-  p->mailbox = (mailbox_t *)result_unwrap(rmb);
+  p->context.sp = p->kstack + KSTACK_SIZE;
 
   return RESULT_SUCCESS(p);
 }
@@ -340,25 +418,41 @@ void free_process(proc_t *p) {
   if (!p)
     return;
 
-  if (p->pagetable) {
-    free_page(p->pagetable);
-    p->pagetable = NULL;
-  }
-
-  if (p->trapframe) {
-    free_page(p->trapframe);
-    p->trapframe = NULL;
-  }
+  // user pages only, the shell's own mappings stay
+  if (p->pagetable && p->pagetable == p->shell_pagetable)
+    uvmdealloc(p, p->sz, 0);
+  p->pagetable = NULL;
 
   p->sz = 0;
+  pid_hash_remove(p);
+  pid_free(p->pid);
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->is_kernel = 0;
+
+  fpu_state_free(&p->fpu);
+
+  acquire(&proc_free_lock);
+  g_bool keep = p->kstack && idle_shells < PROC_SHELL_CACHE_MAX;
+  if (keep)
+    idle_shells++;
+  release(&proc_free_lock);
+
+  if (!keep)
+    shell_destroy(p);
 
   p->state = UNUSED;
+
+  acquire(&proc_free_lock);
+  if (keep)
+    list_push_front(&free_procs, &p->free_node);
+  else
+    list_push_back(&free_procs, &p->free_node);
+  release(&proc_free_lock);
 }
 
 void scheduler() {
@@ -367,61 +461,70 @@ void scheduler() {
   static uint64_t schedule_count = 0;
 
   c->proc = 0;
+  c->online = true;
+
+  // scounteren is per hart: rdcycle for user_bench.S, rdtime for the vdso
+  PS_enable_user_counters(SCOUNTEREN_CY | SCOUNTEREN_TM);
 
   for (;;) {
     PS_enable_interrupts();
 
-    proc_t *highest_priority_proc = NULL;
-    uint8_t highest_priority = 255; // Start with lowest possible priority
-    uint8_t runnable_count = 0;
+    // Next proc from this hart's run queue, stealing if it is empty
+    p = sched_pick_next(c);
 
-    // First pass: find the highest priority (lowest number) RUNNABLE process
-    for (uint8_t i = 0; i < NPROC; i++) {
-      p = &proc[i];
+    if (p) {
       acquire(&p->lock);
-      if (p->state == RUNNABLE) {
-        runnable_count++;
-        if (p->priority < highest_priority) {
-          if (highest_priority_proc) {
-            release(&highest_priority_proc->lock);
-          }
-          highest_priority_proc = p;
-          highest_priority = p->priority;
-          // Don't release lock yet - we'll need it for running the process
-        } else {
-          release(&p->lock);
-        }
-      } else {
+      if (p->state != RUNNABLE) {
         release(&p->lock);
+        continue;
       }
-    }
 
-    if (highest_priority_proc) {
-      // Run the highest priority process
-      highest_priority_proc->state = RUNNING;
-      c->proc = highest_priority_proc;
+      p->state = RUNNING;
+      c->proc = p;
+      c->need_resched = false;
+      c->slice_end = UINT64_MAX;
+      c->exec_start = get_csrr_time();
+      sched_update_tick(c);
 
       // Debug output every 1000 schedules
       if (schedule_count % 1000 == 0) {
         printf("Scheduler: running %{type: str} (pid %{type: int}, priority "
-               "%{type: int}) - %{type: int} runnable\n",
-               PRINT_FLAG_BOTH, highest_priority_proc->name,
-               highest_priority_proc->pid, highest_priority_proc->priority,
-               runnable_count);
+               "%{type: int}) - %{type: int} queued\n",
+               PRINT_FLAG_BOTH, p->name, p->pid, p->priority,
+               c->rq.nr_running);
       }
 
-      swtch(&c->context, &highest_priority_proc->context);
+      swtch(&c->context, &p->context);
+
+      // yield_to() may have handed the hart to another proc meanwhile
+      p = c->proc;
+
+      // a proc that yielded was charged when it was queued again
+      if (p->state != RUNNABLE)
+        sched_account(c, p);
+      fpu_switch_out(c, p);
+
+      // kernel tasks have no parent to reap them
+      if (p->state == ZOMBIE && p->is_kernel)
+        free_process(p);
 
       c->proc = 0;
-      release(&highest_priority_proc->lock);
+      release(&p->lock);
       schedule_count++;
     } else {
       if (schedule_count % 5000 == 0) {
         printf("Scheduler: no runnable processes, waiting...\n",
                PRINT_FLAG_BOTH);
       }
+
+      // Re-check with interrupts off so a wakeup cannot slip in between the
+      // check and wfi. wfi still returns once an interrupt is pending.
+      PS_disable_interrupts();
+      if (c->rq.nr_running == 0) {
+        sched_update_tick(c);
+        asm volatile("wfi");
+      }
       PS_enable_interrupts();
-      asm volatile("wfi");
     }
   }
 }
@@ -435,6 +538,8 @@ void sched(void) {
     panic("sched p->lock");
   if (c->noff != 1)
     panic("sched locks");
+  if (c->preempt_count)
+    panic("sched preempt_count");
   if (p->state == RUNNING)
     panic("sched running");
   if (PS_get_interrupt_enabled())
@@ -442,17 +547,70 @@ void sched(void) {
 
   intena = c->intena;
   swtch(&p->context, &c->context);
-  c->intena = intena;
+  current_cpu()->intena = intena;
+  finish_handoff();
 }
 
 void yield(void) {
   proc_t *p = current_proc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  sched_make_runnable(p);
   sched();
   release(&p->lock);
 }
 
+/*
+ * Called by a proc that was just switched to. If yield_to() switched to it
+ * directly, the previous proc's lock is still held and is released here.
+ */
+static void finish_handoff(void) {
+  cpu_t *c = current_cpu();
+  proc_t *prev = c->handoff_prev;
+
+  if (prev) {
+    c->handoff_prev = NULL;
+    release(&prev->lock);
+  }
+}
+
+g_bool yield_to(proc_t *target) {
+  proc_t *p = current_proc();
+  int intena;
+
+  if (!target || target == p)
+    return false;
+
+  // two proc locks at once, take them in address order
+  if (p < target) {
+    acquire(&p->lock);
+    acquire(&target->lock);
+  } else {
+    acquire(&target->lock);
+    acquire(&p->lock);
+  }
+
+  cpu_t *c = current_cpu();
+  if (c->preempt_count || c->noff != 2)
+    panic("yield_to locks");
+
+  if (!sched_handoff(c, p, target)) {
+    release(&target->lock);
+    release(&p->lock);
+    return false;
+  }
+
+  // switch straight to `target`, which releases our lock in finish_handoff()
+  fpu_switch_out(c, p);
+  c->handoff_prev = p;
+  intena = c->intena;
+  swtch(&p->context, &target->context);
+  current_cpu()->intena = intena;
+  finish_handoff();
+
+  release(&p->lock);
+  return true;
+}
+
 uint8_t initcode[] = {
     // ... (first 24 bytes are unchanged) ...
     0x17, 0x05, 0x00, 0x00, // 0x00: auipc a0, 0
@@ -501,7 +659,7 @@ void first_process() {
 
   strncopy(p->name, "init", sizeof(p->name));
 
-  p->state = RUNNABLE;
+  sched_make_runnable(p);
 
   init_proc = p;
 
@@ -563,33 +721,52 @@ proc_from_code(uint8_t code[], uint64_t size, const char *name) {
     strncopy(p->name, name, sizeof(p->name));
 
   /* mark runnable and release the lock so scheduler can pick it up */
-  p->state = RUNNABLE;
+  sched_make_runnable(p);
   release(&p->lock);
 
   return RESULT_SUCCESS(p);
 }
 
-void wakeup(void *chan) {
-  for (uint8_t i = 0; i < NPROC; i++) {
-    proc_t *p = &proc[i];
+uint64_t wakeup_n(void *chan, uint64_t n) {
+  wait_bucket_t *b = wait_bucket(chan);
+  uint64_t woken = 0;
+
+  acquire(&b->lock);
+  LIST_FOR_EACH_SAFE(it, tmp, &b->waiters) {
+    if (woken == n)
+      break;
+
+    proc_t *p = LIST_ENTRY(it, proc_t, wait_node);
     acquire(&p->lock);
     if (p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+      list_remove(&p->wait_node);
+      sched_make_runnable(p);
+      woken++;
     }
     release(&p->lock);
   }
+  release(&b->lock);
+
+  return woken;
 }
 
+void wakeup(void *chan) { wakeup_n(chan, UINT64_MAX); }
+
+/* hands the children of `p` to init. The caller holds wait_lock. */
 void reparent(proc_t *p) {
-  proc_t *pp = current_proc();
+  if (list_empty(&p->children))
+    return;
 
-  for (uint8_t i = 0; i < NPROC; i++) {
-    proc_t *child = &proc[i];
-    if (child->parent == p) {
-      child->parent = init_proc;
-      wakeup(init_proc);
-    }
+  LIST_FOR_EACH_SAFE(it, tmp, &p->children) {
+    proc_t *child = LIST_ENTRY(it, proc_t, sibling_node);
+    list_remove(&child->sibling_node);
+    child->parent = init_proc;
+    if (init_proc)
+      list_push_back(&init_proc->children, &child->sibling_node);
   }
+
+  if (init_proc)
+    wakeup(init_proc);
 }
 
 void exit(uint64_t status) {
@@ -598,6 +775,14 @@ void exit(uint64_t status) {
   if (p == init_proc)
     panic("init proc exiting");
 
+  // its poller runs syscalls for us, stop it while we still exist
+  io_ring_destroy(p);
+  serial_forget(p);
+
+#ifdef TRAP_STATS_ON_EXIT
+  trap_counts_print(p->name, &p->traps);
+#endif
+
   acquire(&wait_lock);
 
   reparent(p);
@@ -619,10 +804,15 @@ void usertrap(void) {
   if ((PS_get_status() & SSTATUS_SPP) != 0)
     panic("usertrap: not from user mode");
 
-  PS_set_trap_vector((uint64_t)trap_vector);
+  PS_set_trap_vector(kernel_trap_vector());
 
   proc_t *p = current_proc();
 
+  // before anything else can touch sstatus.FS/VS
+  fpu_user_enter(p);
+
+  trap_count(p, PS_get_exception_cause());
+
   // printf("p->pid = %{type: int}\n", PRINT_FLAG_BOTH, p->pid);
   // printf("usertrap: p->name = %{type: str}\n", PRINT_FLAG_BOTH, p->name);
 
@@ -649,7 +839,9 @@ void usertrap(void) {
   //          PS_get_exception_cause());
   // }
 
-  if (PS_get_exception_cause() == 0x2) {
+  if (PS_get_exception_cause() == 0x2 && fpu_handle_illegal(p)) {
+    // first F/D or vector instruction, retried now that the unit is on
+  } else if (PS_get_exception_cause() == 0x2) {
     // print out faulting address and the data there
     uint64_t faulting_address = PS_get_exception_pc();
     uint64_t fault_pa = 0;
@@ -682,25 +874,7 @@ void usertrap(void) {
     // so enable only now that we're done with those registers.
     PS_enable_interrupts();
 
-    // TODO: actual syscall handling
-
-    int callnum = p->trapframe->a7;
-
-    if (callnum == 2) {
-      // exit
-      // int exitcode = p->trapframe->a0;
-      // exit(exitcode);
-    } else if (callnum == 6) {
-      fill_screen_with_color(25, 25, 25);
-    } else if (callnum == 7) {
-      gizm_font_draw_text(20, 20, "Proc A", GIZM_COLOR_BLUE);
-      // fill_screen_with_color(25, 25, 25);
-    } else if (callnum == 8) {
-      gizm_font_draw_text(20, 20, "Proc B", GIZM_COLOR_RED);
-    }
-
-    // default ignore
-    // p->trapframe->a0 = -1;
+    syscall(p);
   }
   // } else if((which_dev = devintr()) != 0){
   //   // ok
@@ -715,8 +889,19 @@ void usertrap(void) {
 
   // // give up the CPU if this is a timer interrupt.
   if (PS_get_exception_cause() == 0x8000000000000005) {
-    // print(ANSI_APPLY(ANSI_COLOR_BLUE, "yielding\n"), PRINT_FLAG_BOTH);
-    yield();
+    timer_interrupt();
+    tasklet_run_pending();
+    if (current_cpu()->need_resched) {
+      // print(ANSI_APPLY(ANSI_COLOR_BLUE, "yielding\n"), PRINT_FLAG_BOTH);
+      trap_count_preemption(p);
+      yield();
+    }
+  } else if (PS_get_exception_cause() == 0x8000000000000001) {
+    software_interrupt();
+    tasklet_run_pending();
+  } else if (PS_get_exception_cause() == 0x8000000000000009) {
+    handle_external_interrupt();
+    tasklet_run_pending();
   }
 
   user_trap_ret();
@@ -736,19 +921,134 @@ g_bool killed(proc_t *p) {
 
 void sleep(void *chan, struct spinlock *lk) {
   proc_t *p = current_proc();
+  wait_bucket_t *b = wait_bucket(chan);
 
+  // Hold the bucket lock from before lk is released until we are queued,
+  // so a wakeup(chan) cannot slip in between. Lock order is bucket, then
+  // p->lock. The caller may pass the bucket lock itself as lk.
+  if (lk != &b->lock)
+    acquire(&b->lock);
   acquire(&p->lock);
-  release(lk);
+  if (lk != &b->lock)
+    release(lk);
 
   p->chan = chan;
   p->state = SLEEPING;
+  list_push_back(&b->waiters, &p->wait_node);
+  release(&b->lock);
 
   sched();
 
   p->chan = NULL;
 
   release(&p->lock);
-  acquire(lk);
+
+  // wakeup() dequeues us, but kill() does not
+  acquire(&b->lock);
+  if (list_linked(&p->wait_node))
+    list_remove(&p->wait_node);
+  if (lk != &b->lock) {
+    release(&b->lock);
+    acquire(lk);
+  }
+}
+
+static void sleep_timer_expired(void *arg) {
+  proc_t *p = (proc_t *)arg;
+
+  acquire(&p->lock);
+  if (p->state == SLEEPING && p->chan == p->timeout_chan) {
+    sched_make_runnable(p);
+  }
+  release(&p->lock);
+}
+
+RESULT_TYPE(void) sleep_timeout(void *chan, struct spinlock *lk,
+                                uint64_t deadline) {
+  proc_t *p = current_proc();
+  wait_bucket_t *b = wait_bucket(chan);
+
+  // same locking as sleep()
+  if (lk != &b->lock)
+    acquire(&b->lock);
+  acquire(&p->lock);
+
+  // p->lock keeps interrupts off, so the timer cannot fire before we are
+  // SLEEPING
+  ktimer_init(&p->sleep_timer, sleep_timer_expired, p);
+  p->timeout_chan = chan;
+  if (!ktimer_arm(&p->sleep_timer, deadline)) {
+    release(&p->lock);
+    if (lk != &b->lock)
+      release(&b->lock);
+    return RESULT_FAILURE(RESULT_NOMEM);
+  }
+
+  if (lk != &b->lock)
+    release(lk);
+
+  p->chan = chan;
+  p->state = SLEEPING;
+  list_push_back(&b->waiters, &p->wait_node);
+  release(&b->lock);
+
+  sched();
+
+  p->chan = NULL;
+  p->timeout_chan = NULL;
+  release(&p->lock);
+
+  ktimer_cancel(&p->sleep_timer);
+
+  // wakeup() dequeues us, the timer and kill() do not
+  acquire(&b->lock);
+  g_bool woken = !list_linked(&p->wait_node);
+  if (!woken)
+    list_remove(&p->wait_node);
+  if (lk != &b->lock) {
+    release(&b->lock);
+    acquire(lk);
+  }
+
+  if (!woken && get_csrr_time() >= deadline)
+    return RESULT_FAILURE(RESULT_TIMEOUT);
+  return RESULT_SUCCESS(0);
+}
+
+void sleep_until(uint64_t deadline) {
+  proc_t *p = current_proc();
+
+  while (get_csrr_time() < deadline) {
+    acquire(&p->lock);
+
+    if (p->killed) {
+      release(&p->lock);
+      break;
+    }
+
+    // p->lock keeps interrupts off, so the timer cannot fire before we
+    // are SLEEPING
+    ktimer_init(&p->sleep_timer, sleep_timer_expired, p);
+    p->timeout_chan = &p->sleep_timer;
+    if (!ktimer_arm(&p->sleep_timer, deadline)) {
+      // timer queue is out of memory, fall back to yielding
+      sched_make_runnable(p);
+      sched();
+      release(&p->lock);
+      continue;
+    }
+
+    p->chan = &p->sleep_timer;
+    p->state = SLEEPING;
+
+    sched();
+
+    p->chan = NULL;
+    release(&p->lock);
+
+    // woken early (e.g. killed), do not leave the timer behind
+    ktimer_cancel(&p->sleep_timer);
+  }
 }
 
 uint64_t wait(uint64_t address) {
@@ -760,62 +1060,132 @@ uint64_t wait(uint64_t address) {
   acquire(&wait_lock);
 
   for (;;) {
-    has_children = 0;
-
-    for (uint8_t i = 0; i < NPROC; i++) {
-      pp = &proc[i];
-      if (pp->parent == p) {
-
-        acquire(&pp->lock);
-        has_children = 1;
-
-        if (pp->state == ZOMBIE) {
-          pid = pp->pid;
-          if (address != 0 &&
-              !result_is_ok(copyout(p->pagetable, address, (void *)&p->xstate,
-                                    sizeof(p->xstate)))) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-
-          free_process(pp);
+    has_children = !list_empty(&p->children);
+
+    LIST_FOR_EACH(it, &p->children) {
+      pp = LIST_ENTRY(it, proc_t, sibling_node);
+
+      acquire(&pp->lock);
+      if (pp->state == ZOMBIE) {
+        pid = pp->pid;
+        if (address != 0 &&
+            !result_is_ok(copyout(p->pagetable, address, (void *)&pp->xstate,
+                                  sizeof(pp->xstate)))) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
 
+        list_remove(&pp->sibling_node);
+        pp->parent = 0;
+        free_process(pp);
         release(&pp->lock);
-      }
-
-      if (!has_children || killed(p)) {
         release(&wait_lock);
-        return -1;
+        return pid;
       }
+      release(&pp->lock);
+    }
 
-      sleep(p, &wait_lock);
+    if (!has_children || killed(p)) {
+      release(&wait_lock);
+      return -1;
     }
+
+    sleep(p, &wait_lock);
   }
 }
 
-RESULT_TYPE(void) kill(uint64_t pid) {
-  proc_t *p;
+/* finds a live proc by pid and returns it with p->lock held, or NULL */
+static proc_t *proc_lookup(uint64_t pid) {
+  if (pid == 0 || pid >= PID_MAX)
+    return NULL;
 
-  for (uint8_t i = 0; i < NPROC; i++) {
-    p = &proc[i];
-    acquire(&p->lock);
-    if (p->pid == pid) {
-      p->killed = 1;
-      if (p->state == SLEEPING) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return RESULT_SUCCESS(0);
-    }
+  proc_t *p = pid_hash_find(pid);
+  if (!p)
+    return NULL;
+
+  // it may have exited, and its proc_t been reused, since the lookup
+  acquire(&p->lock);
+  if (p->state == UNUSED || p->pid != (int)pid) {
     release(&p->lock);
+    return NULL;
   }
 
-  return RESULT_FAILURE(RESULT_NOT_FOUND);
+  return p;
+}
+
+RESULT_TYPE(void) kill(uint64_t pid) {
+  proc_t *p = proc_lookup(pid);
+  if (!p)
+    return RESULT_FAILURE(RESULT_NOT_FOUND);
+
+  p->killed = 1;
+  if (p->state == SLEEPING) {
+    sched_make_runnable(p);
+  }
+  release(&p->lock);
+
+  return RESULT_SUCCESS(0);
+}
+
+RESULT_TYPE(void) set_affinity(uint64_t pid, uint64_t mask) {
+  proc_t *self = current_proc();
+  proc_t *p = proc_lookup(pid == 0 ? self->pid : pid);
+  if (!p)
+    return RESULT_FAILURE(RESULT_NOT_FOUND);
+
+  g_bool ok = sched_set_affinity(p, mask);
+  release(&p->lock);
+  if (!ok)
+    return RESULT_FAILURE(RESULT_INVALID);
+
+  // a running proc only moves when it is queued again
+  if (p == self) {
+    intr_push_off();
+    g_bool allowed = (mask >> cpu_id(current_cpu())) & 1;
+    intr_pop_off();
+    if (!allowed)
+      yield();
+  }
+
+  return RESULT_SUCCESS(0);
+}
+
+RESULT_TYPE(void) proc_send(proc_t *from, uint64_t pid, uint32_t value) {
+  proc_t *to = proc_lookup(pid);
+  if (!to)
+    return RESULT_FAILURE(RESULT_NOT_FOUND);
+
+  // the mailbox is never freed, so it stays valid after the lock is dropped
+  mailbox_t *mb = to->mailbox;
+  g_bool alive = to->state != ZOMBIE;
+  release(&to->lock);
+  if (!alive || !mb)
+    return RESULT_FAILURE(RESULT_NOT_FOUND);
+
+  notification_t n = {
+      .token = 0,
+      .type = NOTIFICATION_TYPE_GIZMO,
+      .value = value,
+      .data = NULL,
+      .sender = from->pid,
+  };
+
+  if (from != current_proc())
+    return mailbox_post(mb, &n);
+
+  // yield_to() declines if `to` is not RUNNABLE, e.g. because it exited
+  return mailbox_send(to, &n);
+}
+
+RESULT_TYPE(uint64_t) get_affinity(uint64_t pid) {
+  proc_t *p = proc_lookup(pid == 0 ? current_proc()->pid : pid);
+  if (!p)
+    return RESULT_FAILURE(RESULT_NOT_FOUND);
+
+  uint64_t mask = p->affinity;
+  release(&p->lock);
+  return RESULT_SUCCESS(mask);
 }
 
 void setkilled(proc_t *p) {
@@ -854,15 +1224,23 @@ uint64_t fork(void) {
 
   proc_t *new_proc = (proc_t *)result_unwrap(rnew_proc);
 
+  // set first, so a partial copy is unmapped by free_process()
+  new_proc->sz = p->sz;
+
   if (!uvmcopy(p->pagetable, new_proc->pagetable, p->sz)) {
     free_process(new_proc);
+    release(&new_proc->lock);
     return -1;
   }
 
-  new_proc->sz = p->sz;
-
   *(new_proc->trapframe) = *(p->trapframe);
 
+  if (!fpu_fork(p, new_proc)) {
+    free_process(new_proc);
+    release(&new_proc->lock);
+    return -1;
+  }
+
   new_proc->trapframe->a0 = 0; // child returns 0
 
   pid = new_proc->pid;
@@ -871,10 +1249,11 @@ uint64_t fork(void) {
 
   acquire(&wait_lock);
   new_proc->parent = p;
+  list_push_back(&p->children, &new_proc->sibling_node);
   release(&wait_lock);
 
   acquire(&new_proc->lock);
-  new_proc->state = RUNNABLE;
+  sched_make_runnable(new_proc);
   release(&new_proc->lock);
 
   return pid;
@@ -900,50 +1279,119 @@ RESULT_TYPE(void) proc_resize(int n) {
   return RESULT_SUCCESS(0);
 }
 
+/* release timer of a periodic task, re-arms itself for the next period */
+static void periodic_release(void *arg) {
+  proc_t *p = (proc_t *)arg;
+
+  acquire(&p->lock);
+  if (p->state == UNUSED || p->state == ZOMBIE) {
+    release(&p->lock);
+    return;
+  }
+
+  sched_periodic_release(p);
+  if (p->state == SLEEPING && p->chan == &p->periodic)
+    sched_make_runnable(p);
+
+  // if the release was late the deadline may have passed already; the
+  // timer then fires again right away and counts the missed period
+  ktimer_arm(&p->periodic.release_timer, p->periodic.deadline);
+  release(&p->lock);
+}
+
+void wait_next_period(void) {
+  proc_t *p = current_proc();
+
+  acquire(&p->lock);
+  if (!p->periodic.period) {
+    release(&p->lock);
+    return;
+  }
+
+  // the job is done even if its budget is not used up
+  p->periodic.job_done = true;
+  while (p->periodic.job_done && !p->killed) {
+    p->chan = &p->periodic;
+    p->state = SLEEPING;
+    sched();
+    p->chan = NULL;
+  }
+
+  release(&p->lock);
+}
+
 void kernel_task_wrapper(void) {
   proc_t *p = current_proc();
   void (*real_entry)(void *) = (void (*)(void *))p->context.s0;
   void *arg = (void *)p->context.s1;
 
+  finish_handoff();
   release(&p->lock); // Release the lock inherited from scheduler
 
   real_entry(arg);
 
-  // If the task returns, mark it as zombie
+  if (p->periodic.period)
+    ktimer_cancel(&p->periodic.release_timer);
+
+  // If the task returns, mark it as zombie. scheduler() frees it once it is
+  // off its kernel stack.
+  acquire(&p->lock);
   p->state = ZOMBIE;
   sched();
+  panic("zombie kernel task");
 }
 
 RESULT_TYPE(proc_t *)
 make_kernel_task(void (*entry)(void *), void *arg, const char *name) {
+  kernel_task_opts_t opts = {0};
+
+  /* Set priority based on task name */
+  if (name && !strcmp(name, "framebufferd")) {
+    opts.priority = PROC_PRIORITY_FLUSH; /* Framebuffer daemon runs last */
+  } else {
+    opts.priority = PROC_PRIORITY_HIGH; /* Other kernel tasks go first */
+  }
+
+  return make_kernel_task_opts(entry, arg, name, &opts);
+}
+
+RESULT_TYPE(proc_t *)
+make_kernel_task_opts(void (*entry)(void *), void *arg, const char *name,
+                      const kernel_task_opts_t *opts) {
   result_t r = make_proc();
   if (!result_is_ok(r))
     return RESULT_FAILURE(RESULT_NOMEM);
 
   proc_t *p = (proc_t *)result_unwrap(r);
 
-  free_page(p->trapframe);
-  p->trapframe = NULL;
-
-  free_page(p->pagetable);
-  p->pagetable = shared_page_table; /* share kernel page table */
+  // the shell stays for a later user proc, the task runs on the kernel's
+  // page table
+  p->pagetable = shared_page_table;
 
   p->is_kernel = 1;
   p->context.ra = (uint64_t)kernel_task_wrapper; /* kernel task entry point */
-  p->context.sp = p->kstack + PAGE_SIZE;         /* top of its kernel stack */
+  p->context.sp = p->kstack + KSTACK_SIZE;       /* top of its kernel stack */
   p->context.s0 = (uint64_t)entry;               /* optional argument */
   p->context.s1 = (uint64_t)arg;
 
   strncopy(p->name, name, sizeof(p->name));
 
-  /* Set priority based on task name */
-  if (name && strcmp(name, "framebufferd")) {
-    p->priority = PROC_PRIORITY_FLUSH; /* Framebuffer daemon runs last */
-  } else {
-    p->priority = PROC_PRIORITY_HIGH; /* Other kernel tasks get high priority */
+  p->priority = opts->priority;
+  p->affinity = opts->affinity ? opts->affinity : SCHED_AFFINITY_ALL;
+
+  if (opts->period_us) {
+    uint64_t now = get_csrr_time();
+    sched_set_periodic(p, timer_us_to_ticks(opts->period_us),
+                       timer_us_to_ticks(opts->budget_us), now);
+    ktimer_init(&p->periodic.release_timer, periodic_release, p);
+    if (!ktimer_arm(&p->periodic.release_timer, p->periodic.deadline)) {
+      free_process(p);
+      release(&p->lock);
+      return RESULT_FAILURE(RESULT_NOMEM);
+    }
   }
 
-  p->state = RUNNABLE;
+  sched_make_runnable(p);
   release(&p->lock);
   return RESULT_SUCCESS(p);
 }
@@ -1,12 +1,15 @@
 #pragma once
 
+#include "lib/fpu.h"
 #include "lib/mailbox.h"
 #include "lib/spinlock.h"
+#include "sched.h"
 #include <lib/context.h>
+#include <lib/list.h>
+#include <lib/timer_queue.h>
 #include <lib/result.h>
 #include <page_table.h>
-
-#define NPROC 64 /* maximum number of processes */
+#include <trap_stats.h>
 
 struct trapframe {
   uint64_t kernel_satp;   /* kernel page table (satp value)      */
@@ -67,36 +70,145 @@ struct proc {
   int xstate;
   int pid;
 
+  /* family, protected by wait_lock */
   struct proc *parent;
+  list_node_t children;     /* procs whose parent this is */
+  list_node_t sibling_node; /* parent->children */
 
   /* kernel context / stack */
-  uint64_t kstack;
+  uint64_t kstack;      /* lowest address of the stack, 0 if none */
+  uint64_t kstack_slot; /* KSTACK() slot, fixed for the life of the proc_t */
   context_t context;
 
   uint64_t sz;
-  page_table_t *pagetable;
-  struct trapframe *trapframe; /* TRAPFRAME page */
+  page_table_t *pagetable;       /* shell_pagetable, or the kernel's */
+  page_table_t *shell_pagetable; /* own root, kept while UNUSED */
+  struct trapframe *trapframe;   /* TRAPFRAME page */
 
   char name[16];
 
   g_bool is_kernel; /* true if this is a kernel task */
 
+  fpu_state_t fpu; /* lazily switched FP/vector state, see lib/fpu.h */
+
   mailbox_t *mailbox; /* mailbox for notifications */
+  struct io_ring *io_ring; /* batched syscalls, see io_ring.h */
+
+  /* run queue membership, see sched.c */
+  heap_node_t rq_node;     /* rq_node.key mirrors vruntime while queued */
+  uint64_t vruntime;       /* weighted runtime (timer ticks), see sched.h */
+  int cpu;                 /* hart this proc is queued on / last ran on */
+  uint64_t last_migration; /* time (timer ticks) it was last stolen */
+  uint64_t migrations;     /* number of times it was stolen */
+  uint64_t affinity;       /* harts it may run on, bit i = hart i */
+  sched_periodic_t periodic; /* real-time parameters, see sched.h */
+
+  trap_counts_t traps; /* traps taken while it ran, see trap_stats.h */
+
+  ktimer_t sleep_timer; /* wakes the proc from sleep_until() */
+  void *timeout_chan;   /* chan sleep_timer ends the sleep on */
+  list_node_t wait_node; /* wait channel bucket, see lib/wait_queue.h */
+
+  /* process table, see proc.c */
+  list_node_t table_node; /* all_procs */
+  list_node_t free_node;  /* free_procs while UNUSED */
+  list_node_t pid_node;   /* PID hash bucket, see pid.h */
 };
 
 typedef struct proc proc_t;
-extern proc_t proc[NPROC];
+
+/* Idle proc shells kept for reuse, see free_process() */
+#ifndef PROC_SHELL_CACHE_MAX
+#define PROC_SHELL_CACHE_MAX 32
+#endif
 
 g_bool initialize_processes();
 void first_process();
 RESULT_TYPE(proc_t *) make_proc();
+
+/*
+ * Frees the user memory of `p` and returns it to the process table. Its
+ * shell (kernel stack, trapframe and root page table) is kept for the next
+ * make_proc() while fewer than PROC_SHELL_CACHE_MAX are idle. The caller
+ * holds p->lock.
+ */
+void free_process(proc_t *p);
 void scheduler();
 void yield(void);
+void exit(uint64_t status);
+
+/*
+ * Switches straight to `target` on this hart, skipping the scheduler, and
+ * gives it the rest of the caller's timeslice. The caller is queued again as
+ * by yield(). Returns false without switching if `target` is not RUNNABLE
+ * or may not run on this hart. Must not be called with locks held.
+ */
+g_bool yield_to(proc_t *target);
 g_bool proc_grow(proc_t *p, uint64_t n);
 g_bool proc_shrink(proc_t *p, uint64_t n);
 RESULT_TYPE(void) proc_resize(int n);
 RESULT_TYPE(proc_t *)
 proc_from_code(uint8_t code[], uint64_t size, const char *name);
 
+/*
+ * Atomically releases `lk` and sleeps on `chan`, reacquiring `lk` when woken
+ * by wakeup(chan) or kill().
+ */
+void sleep(void *chan, struct spinlock *lk);
+void wakeup(void *chan);
+
+/* Wakes at most `n` procs sleeping on `chan`, oldest first. Returns how many. */
+uint64_t wakeup_n(void *chan, uint64_t n);
+
+/*
+ * Like sleep(), but gives up once the `time` CSR reaches `deadline`. Fails
+ * with RESULT_TIMEOUT if nothing woke it by then and with RESULT_NOMEM if
+ * the timer could not be armed, in which case it did not sleep.
+ */
+RESULT_TYPE(void) sleep_timeout(void *chan, struct spinlock *lk,
+                                uint64_t deadline);
+g_bool killed(proc_t *p);
+
+/* Blocks the current proc until the `time` CSR reaches `deadline`. */
+void sleep_until(uint64_t deadline);
+
 RESULT_TYPE(proc_t *)
 make_kernel_task(void (*entry)(void *), void *arg, const char *name);
+
+/* Scheduling parameters of a kernel task, see make_kernel_task_opts(). */
+typedef struct kernel_task_opts {
+  uint8_t priority;   /* PROC_PRIORITY_*, the weight as a fair proc */
+  uint64_t period_us; /* release period, 0 for a fair-only task */
+  uint64_t budget_us; /* CPU time reserved per period */
+  uint64_t affinity;  /* harts it may run on, 0 for any */
+} kernel_task_opts_t;
+
+/*
+ * Like make_kernel_task(), with explicit scheduling parameters. A task with
+ * a period is released every `period_us` and calls wait_next_period() at the
+ * end of each job.
+ */
+RESULT_TYPE(proc_t *)
+make_kernel_task_opts(void (*entry)(void *), void *arg, const char *name,
+                      const kernel_task_opts_t *opts);
+
+/*
+ * Ends the current job of a periodic task and blocks until its next release.
+ * Returns immediately if the task was killed or is not periodic.
+ */
+void wait_next_period(void);
+
+/*
+ * Restricts `pid` (0 for the caller) to the harts in `mask`, bit i = hart i.
+ * Fails if no hart in `mask` exists. The caller moves off a hart it may no
+ * longer use before this returns.
+ */
+RESULT_TYPE(void) set_affinity(uint64_t pid, uint64_t mask);
+
+/*
+ * Sends `value` to the proc `pid` as a NOTIFICATION_TYPE_GIZMO from `from`.
+ * From the running proc this is mailbox_send(), which hands the receiver the
+ * hart; an io_ring poller sending on its owner's behalf only posts.
+ */
+RESULT_TYPE(void) proc_send(proc_t *from, uint64_t pid, uint32_t value);
+RESULT_TYPE(uint64_t) get_affinity(uint64_t pid);
@@ -0,0 +1,543 @@
+#include "sched.h"
+#include "lib/cpu.h"
+#include "lib/print.h"
+#include "lib/sbi.h"
+#include "lib/timer.h"
+#include "proc.h"
+
+#include <lib/panic.h>
+#include <stddef.h>
+
+/*
+ * Per-hart run queues with work stealing.
+ *
+ * Every hart schedules from its own queue and only takes its own queue lock
+ * on the fast path. A hart whose queue runs dry steals half of the queued
+ * procs of the busiest hart, locking the two queues in address order.
+ *
+ * Within a queue periodic procs with budget left run first, earliest deadline
+ * first, and the other procs are ordered by vruntime (see sched.h). A proc's
+ * vruntime is only meaningful relative to its queue's min_vruntime, so it is
+ * rebased when the proc moves to another hart. Only fair procs are stolen.
+ *
+ * While a proc sits on a queue its rq_node, vruntime, cpu, last_migration and
+ * migrations fields are protected by that queue's lock. While it runs, only
+ * its own hart touches its vruntime.
+ */
+
+#define NODE_TO_PROC(n) ((proc_t *)((char *)(n) - offsetof(proc_t, rq_node)))
+
+/*
+ * Weights of the priorities PROC_PRIORITY_NORMAL - 20 through
+ * PROC_PRIORITY_NORMAL + 19. Each step is worth about 10% of CPU time against
+ * a proc one step away; these are the nice level weights used by Linux.
+ */
+static const uint32_t prio_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
+static uint64_t min_granularity = SCHED_MIN_GRANULARITY_TICKS;
+
+uint32_t sched_weight(uint8_t priority) {
+  int level = (int)priority - PROC_PRIORITY_NORMAL + 20;
+  if (level < 0)
+    level = 0;
+  if (level > 39)
+    level = 39;
+  return prio_to_weight[level];
+}
+
+void sched_set_min_granularity(uint64_t ticks) {
+  min_granularity = ticks ? ticks : 1;
+}
+
+uint64_t sched_min_granularity(void) { return min_granularity; }
+
+g_bool runqueue_init(runqueue_t *rq) {
+  initlock(&rq->lock, "runqueue");
+  if (!heap_init(&rq->tasks))
+    return false;
+  if (!heap_init(&rq->dl_tasks)) {
+    heap_destroy(&rq->tasks);
+    return false;
+  }
+  rq->nr_running = 0;
+  rq->load = 0;
+  rq->min_vruntime = 0;
+  rq->next_steal = 0;
+  rq->steals = 0;
+  rq->migrations_in = 0;
+  rq->migrations_out = 0;
+  rq->steal_cycles = 0;
+  return true;
+}
+
+void sched_init(void) {
+  for (int i = 0; i < NCPU; i++) {
+    if (!runqueue_init(&cpus[i].rq))
+      panic("sched_init: out of memory");
+    cpus[i].slice_end = UINT64_MAX;
+    cpus[i].exec_start = 0;
+    cpus[i].need_resched = false;
+    cpus[i].handoff_prev = NULL;
+  }
+}
+
+/* min_vruntime follows the smallest vruntime on the hart but never drops */
+static void update_min_vruntime(runqueue_t *rq, proc_t *curr) {
+  uint64_t vruntime = UINT64_MAX;
+
+  if (curr)
+    vruntime = curr->vruntime;
+
+  heap_node_t *first = heap_peek(&rq->tasks);
+  if (first && first->key < vruntime)
+    vruntime = first->key;
+
+  if (vruntime != UINT64_MAX && vruntime > rq->min_vruntime)
+    rq->min_vruntime = vruntime;
+}
+
+/* a periodic proc with budget left in its current period */
+static g_bool periodic_active(proc_t *p) {
+  return p->periodic.period && p->periodic.remaining > 0;
+}
+
+static g_bool on_heap(heap_t *h, heap_node_t *n) {
+  return n->index && n->index <= h->len && h->nodes[n->index] == n;
+}
+
+void runqueue_enqueue(runqueue_t *rq, proc_t *p) {
+  if (periodic_active(p)) {
+    p->rq_node.key = p->periodic.deadline;
+    if (!heap_push(&rq->dl_tasks, &p->rq_node))
+      panic("runqueue_enqueue: out of memory");
+    rq->nr_running++;
+    return;
+  }
+
+  if (p->vruntime < rq->min_vruntime)
+    p->vruntime = rq->min_vruntime;
+
+  p->rq_node.key = p->vruntime;
+  if (!heap_push(&rq->tasks, &p->rq_node))
+    panic("runqueue_enqueue: out of memory");
+
+  rq->nr_running++;
+  rq->load += sched_weight(p->priority);
+}
+
+static void runqueue_remove(runqueue_t *rq, proc_t *p) {
+  if (on_heap(&rq->dl_tasks, &p->rq_node)) {
+    heap_remove(&rq->dl_tasks, &p->rq_node);
+    rq->nr_running--;
+    return;
+  }
+
+  heap_remove(&rq->tasks, &p->rq_node);
+  rq->nr_running--;
+  rq->load -= sched_weight(p->priority);
+}
+
+proc_t *runqueue_pick(runqueue_t *rq) {
+  heap_node_t *n = heap_peek(&rq->dl_tasks);
+  if (!n)
+    n = heap_peek(&rq->tasks);
+  if (!n)
+    return NULL;
+
+  proc_t *p = NODE_TO_PROC(n);
+  runqueue_remove(rq, p);
+  return p;
+}
+
+void runqueue_charge(runqueue_t *rq, proc_t *p, uint64_t ticks) {
+  // time within the budget is not fair-share time
+  if (periodic_active(p)) {
+    uint64_t used = p->periodic.remaining;
+    if (ticks < used)
+      used = ticks;
+    p->periodic.remaining -= used;
+    ticks -= used;
+    if (p->periodic.remaining == 0 && !p->periodic.job_done)
+      p->periodic.overruns++;
+  }
+
+  p->vruntime += ticks * SCHED_NICE_0_WEIGHT / sched_weight(p->priority);
+  update_min_vruntime(rq, p);
+}
+
+uint64_t runqueue_slice(runqueue_t *rq, proc_t *p) {
+  if (periodic_active(p))
+    return p->periodic.remaining;
+
+  uint64_t weight = sched_weight(p->priority);
+  uint64_t slice = SCHED_LATENCY_TICKS * weight / (rq->load + weight);
+
+  return slice < min_granularity ? min_granularity : slice;
+}
+
+/*
+ * Takes `p` off the queue it is on. Returns false if a hart picked it in the
+ * meantime (sched_pick_next() does not take p->lock). p->lock held.
+ */
+static g_bool runqueue_dequeue(proc_t *p) {
+  // p->cpu only changes under the queue lock, so check it again after
+  for (;;) {
+    runqueue_t *rq = &cpus[p->cpu].rq;
+    acquire(&rq->lock);
+    if (&cpus[p->cpu].rq != rq) {
+      release(&rq->lock);
+      continue;
+    }
+
+    g_bool queued = heap_node_queued(&p->rq_node);
+    if (queued)
+      runqueue_remove(rq, p);
+    release(&rq->lock);
+    return queued;
+  }
+}
+
+/* a queued periodic proc should take the hart from `curr` right away */
+static g_bool runqueue_should_preempt(runqueue_t *rq, proc_t *curr) {
+  heap_node_t *first = heap_peek(&rq->dl_tasks);
+  if (!first)
+    return false;
+  if (!periodic_active(curr))
+    return true;
+  return first->key < curr->periodic.deadline;
+}
+
+void sched_set_periodic(proc_t *p, uint64_t period, uint64_t budget,
+                        uint64_t now) {
+  if (heap_node_queued(&p->rq_node))
+    panic("sched_set_periodic: queued");
+
+  p->periodic.period = period;
+  p->periodic.budget = budget < period ? budget : period;
+  p->periodic.deadline = now + period;
+  p->periodic.remaining = p->periodic.budget;
+  p->periodic.job_done = false;
+  p->periodic.releases = 1;
+  p->periodic.misses = 0;
+  p->periodic.overruns = 0;
+}
+
+static void periodic_refill(proc_t *p) {
+  sched_periodic_t *pt = &p->periodic;
+
+  pt->releases++;
+  if (!pt->job_done)
+    pt->misses++;
+
+  pt->deadline += pt->period;
+  pt->remaining = pt->budget;
+  pt->job_done = false;
+}
+
+void sched_periodic_release(proc_t *p) {
+  if (!holding(&p->lock))
+    panic("sched_periodic_release: lock");
+
+  // not queued (running or blocked), the new budget applies once it is
+  if (p->state != RUNNABLE || !runqueue_dequeue(p)) {
+    periodic_refill(p);
+    return;
+  }
+
+  // queued: its key changes and it may move back to the deadline heap.
+  // Queueing it again also kicks its hart, which may be running a fair
+  // proc that should now yield.
+  periodic_refill(p);
+  sched_make_runnable(p);
+}
+
+static g_bool cpu_allowed(proc_t *p, int id) {
+  return (p->affinity >> id) & 1;
+}
+
+g_bool sched_set_affinity(proc_t *p, uint64_t mask) {
+  if (!holding(&p->lock))
+    panic("sched_set_affinity: lock");
+
+  if (NCPU < 64)
+    mask &= (1UL << NCPU) - 1;
+  if (!mask)
+    return false;
+
+  p->affinity = mask;
+
+  // queued on a hart it may no longer use: queue it again
+  if (p->state == RUNNABLE && !cpu_allowed(p, p->cpu) &&
+      runqueue_dequeue(p))
+    sched_make_runnable(p);
+
+  return true;
+}
+
+/* keeps how far `p` is ahead of the queue floor when it changes hart */
+static void migrate_vruntime(proc_t *p, runqueue_t *from, runqueue_t *to) {
+  uint64_t ahead = 0;
+
+  if (p->vruntime > from->min_vruntime)
+    ahead = p->vruntime - from->min_vruntime;
+
+  p->vruntime = to->min_vruntime + ahead;
+}
+
+static cpu_t *least_loaded_cpu(proc_t *p, g_bool honour_affinity) {
+  cpu_t *best = NULL;
+
+  for (int i = 0; i < NCPU; i++) {
+    cpu_t *c = &cpus[i];
+    if (!c->online || (honour_affinity && !cpu_allowed(p, i)))
+      continue;
+    if (!best || c->rq.nr_running < best->rq.nr_running)
+      best = c;
+  }
+
+  return best;
+}
+
+/*
+ * Picks the queue for a proc that became RUNNABLE. The queue lengths are read
+ * without their locks; a stale value only makes the placement less balanced.
+ */
+static cpu_t *select_cpu(proc_t *p) {
+  if (p->cpu >= 0 && p->cpu < NCPU && cpus[p->cpu].online &&
+      cpu_allowed(p, p->cpu)) {
+    return &cpus[p->cpu];
+  }
+
+  cpu_t *best = least_loaded_cpu(p, true);
+  if (!best)
+    best = least_loaded_cpu(p, false);
+
+  /* no hart has entered scheduler() yet, queue on the booting hart */
+  return best ? best : current_cpu();
+}
+
+void sched_account(cpu_t *c, proc_t *p) {
+  uint64_t now = get_csrr_time();
+  uint64_t ran = now - c->exec_start;
+  c->exec_start = now;
+
+  acquire(&c->rq.lock);
+  runqueue_charge(&c->rq, p, ran);
+  release(&c->rq.lock);
+}
+
+void sched_make_runnable(proc_t *p) {
+  if (!holding(&p->lock))
+    panic("sched_make_runnable: lock");
+  if (heap_node_queued(&p->rq_node))
+    panic("sched_make_runnable: already queued");
+
+  cpu_t *c = select_cpu(p);
+  cpu_t *self = current_cpu();
+
+  // bring the local min_vruntime up to date, and charge `p` if it is the
+  // running proc yielding the hart
+  if (c == self && self->proc)
+    sched_account(self, self->proc);
+
+  p->state = RUNNABLE;
+
+  acquire(&c->rq.lock);
+  // the old hart's min_vruntime is read unlocked, it only ever grows
+  if (p->cpu >= 0 && p->cpu < NCPU && p->cpu != cpu_id(c))
+    migrate_vruntime(p, &cpus[p->cpu].rq, &c->rq);
+  runqueue_enqueue(&c->rq, p);
+  p->cpu = cpu_id(c);
+  release(&c->rq.lock);
+
+  // the target hart may be idle or tickless, make it look at its queue
+  if (c == self)
+    sched_update_tick(c);
+  else
+    sbi_send_ipi(1UL << cpu_id(c), 0);
+}
+
+g_bool sched_handoff(cpu_t *c, proc_t *prev, proc_t *next) {
+  if (!holding(&prev->lock) || !holding(&next->lock))
+    panic("sched_handoff: lock");
+  if (c->proc != prev)
+    panic("sched_handoff: not running");
+
+  if (next->state != RUNNABLE || !cpu_allowed(next, cpu_id(c)))
+    return false;
+  if (!runqueue_dequeue(next))
+    return false;
+
+  // pulled over from another hart: keep its place relative to the floor
+  if (next->cpu != cpu_id(c)) {
+    acquire(&c->rq.lock);
+    migrate_vruntime(next, &cpus[next->cpu].rq, &c->rq);
+    release(&c->rq.lock);
+    next->cpu = cpu_id(c);
+  }
+
+  // `next` inherits what is left of the slice, not a fresh one
+  uint64_t slice_end = c->slice_end;
+
+  sched_account(c, prev);
+  sched_make_runnable(prev);
+
+  next->state = RUNNING;
+  c->proc = next;
+  c->need_resched = false;
+  c->slice_end = slice_end;
+  c->exec_start = get_csrr_time();
+  c->handoffs++;
+  sched_update_tick(c);
+
+  return true;
+}
+
+static cpu_t *find_busiest_cpu(cpu_t *self) {
+  cpu_t *busiest = NULL;
+
+  for (int i = 0; i < NCPU; i++) {
+    cpu_t *c = &cpus[i];
+    if (c == self || !c->online || c->rq.nr_running == 0)
+      continue;
+    if (!busiest || c->rq.nr_running > busiest->rq.nr_running)
+      busiest = c;
+  }
+
+  return busiest;
+}
+
+/*
+ * Moves half of the busiest hart's queued procs onto `c`. Procs are taken
+ * from the bottom of the victim's heap, which holds the procs that would run
+ * last, skipping any that migrated within the cooldown period.
+ */
+static g_bool runqueue_steal(cpu_t *c) {
+  uint64_t now = get_csrr_time();
+  if (now < c->rq.next_steal)
+    return false;
+
+  cpu_t *victim = find_busiest_cpu(c);
+  if (!victim) {
+    c->rq.next_steal = now + SCHED_STEAL_COOLDOWN_TICKS;
+    return false;
+  }
+
+  uint64_t start = get_time_in_cycles();
+
+  runqueue_t *first = (c < victim) ? &c->rq : &victim->rq;
+  runqueue_t *second = (c < victim) ? &victim->rq : &c->rq;
+  acquire(&first->lock);
+  acquire(&second->lock);
+
+  uint32_t want = (victim->rq.nr_running + 1) / 2;
+  uint32_t moved = 0;
+
+  // removing slot i only moves the last node, which we have already seen
+  heap_t *h = &victim->rq.tasks;
+  for (g_usize i = heap_len(h); i > 0 && moved < want; i--) {
+    proc_t *p = NODE_TO_PROC(h->nodes[i]);
+
+    if (!cpu_allowed(p, cpu_id(c)))
+      continue;
+
+    if (p->migrations == 0 ||
+        now - p->last_migration >= SCHED_MIGRATION_COOLDOWN_TICKS) {
+      runqueue_remove(&victim->rq, p);
+      migrate_vruntime(p, &victim->rq, &c->rq);
+      runqueue_enqueue(&c->rq, p);
+      p->cpu = cpu_id(c);
+      p->last_migration = now;
+      p->migrations++;
+      moved++;
+    }
+  }
+
+  victim->rq.migrations_out += moved;
+  c->rq.migrations_in += moved;
+
+  release(&second->lock);
+  release(&first->lock);
+
+  if (moved == 0) {
+    c->rq.next_steal = now + SCHED_STEAL_COOLDOWN_TICKS;
+    return false;
+  }
+
+  c->rq.steals++;
+  c->rq.steal_cycles += get_time_in_cycles() - start;
+  return true;
+}
+
+proc_t *sched_pick_next(cpu_t *c) {
+  runqueue_t *rq = &c->rq;
+  proc_t *p = NULL;
+
+  if (rq->nr_running == 0)
+    runqueue_steal(c);
+
+  acquire(&rq->lock);
+  p = runqueue_pick(rq);
+  release(&rq->lock);
+
+  return p;
+}
+
+void sched_update_tick(cpu_t *c) {
+  if (c->proc && c->rq.nr_running > 0) {
+    // others are waiting, start a timeslice unless one is running already.
+    // An earlier deadline ends the slice now.
+    acquire(&c->rq.lock);
+    if (!c->need_resched && runqueue_should_preempt(&c->rq, c->proc))
+      c->slice_end = get_csrr_time();
+    else if (c->slice_end == UINT64_MAX)
+      c->slice_end = get_csrr_time() + runqueue_slice(&c->rq, c->proc);
+    release(&c->rq.lock);
+  } else {
+    c->slice_end = UINT64_MAX;
+  }
+
+  uint64_t next = timer_queue_next_deadline();
+  if (c->slice_end < next)
+    next = c->slice_end;
+
+  // an idle hart wakes up for its next steal attempt while others are busy
+  if (!c->proc && c->rq.nr_running == 0 && c->rq.next_steal < next &&
+      find_busiest_cpu(c))
+    next = c->rq.next_steal;
+
+  if (next != c->timers.programmed)
+    timer_program(next);
+}
+
+void sched_timer_tick(cpu_t *c) {
+  if (c->proc)
+    sched_account(c, c->proc);
+
+  if (get_csrr_time() < c->slice_end)
+    return;
+
+  c->slice_end = UINT64_MAX;
+  if (c->proc)
+    c->need_resched = true;
+}
+
+void sched_print_stats(void) {
+  for (int i = 0; i < NCPU; i++) {
+    cpu_t *c = &cpus[i];
+    if (!c->online)
+      continue;
+
+    printf("hart %{type: int}: %{type: int} queued, %{type: int} steals, "
+           "%{type: int} in, %{type: int} out, %{type: int} steal cycles, "
+           "%{type: int} kernel preemptions, %{type: int} handoffs\n",
+           PRINT_FLAG_BOTH, i, c->rq.nr_running, c->rq.steals,
+           c->rq.migrations_in, c->rq.migrations_out, c->rq.steal_cycles,
+           c->preemptions, c->handoffs);
+  }
+}
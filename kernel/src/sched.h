@@ -0,0 +1,180 @@
+#pragma once
+
+#include <lib/heap.h>
+#include <lib/spinlock.h>
+#include <lib/timer_queue.h>
+#include <lib/types.h>
+#include <stdint.h>
+
+/* forward declarations, see proc.h and lib/cpu.h */
+typedef struct proc proc_t;
+struct cpu;
+
+/*
+ * A task that was just migrated stays on its new hart for at least this many
+ * timer ticks before it may be stolen again, so that two idle harts cannot
+ * bounce it back and forth.
+ */
+#define SCHED_MIGRATION_COOLDOWN_TICKS 100000 /* 10ms at 10MHz */
+
+/* Affinity mask allowing every hart, bit i stands for hart i */
+#define SCHED_AFFINITY_ALL UINT64_MAX
+
+/* An idle hart that found nothing to steal waits this long before retrying */
+#define SCHED_STEAL_COOLDOWN_TICKS 10000 /* 1ms at 10MHz */
+
+/*
+ * Fair-share scheduling.
+ *
+ * Every proc accumulates a virtual runtime: the time it ran, scaled by
+ * NICE_0 / weight, where the weight is derived from its priority (see
+ * sched_weight()). The run queue always picks the proc with the smallest
+ * vruntime, so over time each proc gets CPU time in proportion to its weight.
+ *
+ * Procs sharing a hart split SCHED_LATENCY_TICKS between them by weight, but
+ * no slice is shorter than the minimum granularity.
+ */
+#define SCHED_NICE_0_WEIGHT 1024
+#define SCHED_LATENCY_TICKS 200000        /* 20ms at 10MHz */
+#define SCHED_MIN_GRANULARITY_TICKS 30000 /* 3ms at 10MHz */
+
+/*
+ * Periodic real-time class.
+ *
+ * A periodic proc is released every `period` ticks and may then run for up
+ * to `budget` ticks before the end of the period, its deadline. While it has
+ * budget left it is queued by earliest deadline and runs ahead of every fair
+ * proc; once the budget is spent it competes as a fair proc until its next
+ * release. A job that has not finished (see wait_next_period()) when the next
+ * release comes counts as a deadline miss.
+ *
+ * Fields other than the timer are protected by the proc's lock.
+ */
+typedef struct sched_periodic {
+  uint64_t period;    /* ticks, 0 for a fair-only proc */
+  uint64_t budget;    /* ticks of CPU time per period */
+  uint64_t deadline;  /* end of the current period, also the next release */
+  uint64_t remaining; /* budget left in the current period */
+  g_bool job_done;    /* current job finished, waiting for the next release */
+  ktimer_t release_timer;
+
+  /* accounting */
+  uint64_t releases; /* periods started */
+  uint64_t misses;   /* releases that found the previous job unfinished */
+  uint64_t overruns; /* jobs that ran out of budget */
+} sched_periodic_t;
+
+/*
+ * Per-hart run queue. Holds the RUNNABLE procs assigned to one hart: periodic
+ * procs with budget left in a min-heap keyed by deadline, all others in a
+ * min-heap keyed by vruntime. The running proc is not on the queue. Each
+ * queue has its own lock; there is no global scheduler lock.
+ */
+typedef struct runqueue {
+  struct spinlock lock;
+  heap_t tasks;          /* fair proc rq_nodes, keyed by vruntime */
+  heap_t dl_tasks;       /* periodic proc rq_nodes, keyed by deadline */
+  uint32_t nr_running;   /* number of procs on both heaps */
+  uint64_t load;         /* sum of the weights of the procs on `tasks` */
+  uint64_t min_vruntime; /* monotonic floor for the vruntime of new procs */
+
+  uint64_t next_steal; /* earliest time (timer ticks) for the next steal */
+
+  /* migration accounting */
+  uint64_t steals;         /* successful steal operations by this hart */
+  uint64_t migrations_in;  /* procs pulled onto this hart */
+  uint64_t migrations_out; /* procs stolen from this hart */
+  uint64_t steal_cycles;   /* cycles spent moving procs onto this hart */
+} runqueue_t;
+
+/* Initialises the run queue of every hart. Called once at boot. */
+void sched_init(void);
+
+/* Sets the shortest timeslice, in timer ticks. */
+void sched_set_min_granularity(uint64_t ticks);
+uint64_t sched_min_granularity(void);
+
+/* Load weight of a proc priority, SCHED_NICE_0_WEIGHT for the normal one. */
+uint32_t sched_weight(uint8_t priority);
+
+/*
+ * Run queue primitives, used by the scheduler and by tests/sched_test.c.
+ * The caller holds rq->lock.
+ *
+ * runqueue_enqueue() never lets a proc start below the queue's min_vruntime,
+ * so a proc that slept or was just created cannot monopolise the hart.
+ * runqueue_charge() adds `ticks` of runtime to a proc that is not queued.
+ * runqueue_slice() is the timeslice `p` gets against the queued procs.
+ */
+g_bool runqueue_init(runqueue_t *rq);
+void runqueue_enqueue(runqueue_t *rq, proc_t *p);
+proc_t *runqueue_pick(runqueue_t *rq);
+void runqueue_charge(runqueue_t *rq, proc_t *p, uint64_t ticks);
+uint64_t runqueue_slice(runqueue_t *rq, proc_t *p);
+
+/*
+ * Makes `p` a periodic proc whose first period starts at `now`. The caller
+ * holds p->lock, `p` is not queued yet. The caller then arms
+ * p->periodic.release_timer for p->periodic.deadline.
+ */
+void sched_set_periodic(proc_t *p, uint64_t period, uint64_t budget,
+                        uint64_t now);
+
+/*
+ * Starts the next period of `p`: refills its budget, moves its deadline and
+ * counts a miss if the previous job is unfinished. A queued proc is moved
+ * back to the deadline queue. The caller holds p->lock.
+ */
+void sched_periodic_release(proc_t *p);
+
+/*
+ * Marks `p` RUNNABLE and queues it on a hart. The proc keeps the hart it last
+ * ran on if that hart is online and in its affinity mask, otherwise the least
+ * loaded allowed hart is chosen. If `p` is the proc running on this hart, its
+ * runtime is charged first. The caller must hold p->lock.
+ */
+void sched_make_runnable(proc_t *p);
+
+/*
+ * Restricts `p` to the harts in `mask`. A queued proc moves to an allowed
+ * hart right away, a running one the next time it is queued. Fails if the
+ * mask contains no hart at all. The caller must hold p->lock.
+ *
+ * If none of the allowed harts is online the proc runs wherever it can
+ * rather than not at all.
+ */
+g_bool sched_set_affinity(proc_t *p, uint64_t mask);
+
+/*
+ * Directed switch from `prev`, the proc running on hart `c`, to `next`: queues
+ * `prev` again and makes `next` the running proc, leaving it the rest of
+ * prev's timeslice. Fails if `next` is not RUNNABLE or may not run on `c`.
+ * The caller holds both procs' locks and does the context switch.
+ */
+g_bool sched_handoff(struct cpu *c, proc_t *prev, proc_t *next);
+
+/*
+ * Charges the proc running on hart `c` for the time since it was last
+ * charged. Called by the scheduler when a proc stops running.
+ */
+void sched_account(struct cpu *c, proc_t *p);
+
+/*
+ * Returns the next proc to run on hart `c`, or NULL if there is none. When
+ * the local queue is empty, half of the busiest hart's queue is stolen first.
+ * The returned proc is no longer queued; its lock is not held.
+ */
+proc_t *sched_pick_next(struct cpu *c);
+
+/*
+ * Programs hart `c`'s timer interrupt for its next event: the earliest kernel
+ * timer, or the end of the running proc's timeslice (see runqueue_slice()) if
+ * other procs are waiting. An idle hart, or one running a single proc, gets no periodic
+ * tick. Must be called on hart `c` with interrupts disabled.
+ */
+void sched_update_tick(struct cpu *c);
+
+/* Called from the timer interrupt, flags the running proc for preemption */
+void sched_timer_tick(struct cpu *c);
+
+void sched_print_stats(void);
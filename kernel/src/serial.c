@@ -0,0 +1,112 @@
+#include "serial.h"
+#include "device/shared.h"
+#include "lib/cpu.h"
+#include "lib/mailbox.h"
+#include "lib/notification.h"
+#include "lib/usermem.h"
+#include "proc.h"
+
+static struct spinlock serial_lock = {.locked = false, .name = "serial"};
+static proc_t *subscriber; /* protected by serial_lock */
+static g_bool notified;    /* a notification is waiting to be read */
+
+/* tells the subscriber, if any, that `readable` bytes can be read */
+static void serial_post(uint32_t readable) {
+  acquire(&serial_lock);
+  if (subscriber && !notified) {
+    notification_t n = {
+        .token = 0,
+        .type = NOTIFICATION_TYPE_UART,
+        .value = readable,
+        .data = NULL,
+    };
+    notified = result_is_ok(mailbox_post(subscriber->mailbox, &n));
+  }
+  release(&serial_lock);
+}
+
+void serial_handle_irq(void *ctx) {
+  uart_t *uart = ctx;
+
+  uint32_t readable = uart_handle_irq(uart);
+  if (!readable)
+    return;
+
+  // one wakeup and one notification per interrupt, not per byte
+  wakeup(&uart->rx_tail);
+  serial_post(readable);
+}
+
+RESULT_TYPE(uint64_t) serial_read(proc_t *p, uint64_t addr, uint64_t len) {
+  char buf[SERIAL_READ_MAX];
+  uart_t *uart = shared_uart;
+
+  // it sleeps as the caller, an io_ring poller cannot block for it
+  if (p != current_proc())
+    return RESULT_FAILURE(RESULT_INVALID);
+  if (!shared_uart_initialized)
+    return RESULT_FAILURE(RESULT_NOENT);
+  if (len > sizeof(buf))
+    len = sizeof(buf);
+  if (len == 0)
+    return RESULT_SUCCESS(0);
+
+  // the line leaves the ring once read, so the copy must not fail after it
+  if (!user_writable(p->pagetable, addr, len))
+    return RESULT_FAILURE(RESULT_FAULT);
+
+  uint32_t n = 0;
+  while (n == 0) {
+    acquire(&uart->rx_lock);
+    while (uart_readable(uart) == 0) {
+      if (killed(p)) {
+        release(&uart->rx_lock);
+        return RESULT_SUCCESS(0);
+      }
+      sleep(&uart->rx_tail, &uart->rx_lock);
+    }
+    release(&uart->rx_lock);
+
+    // another reader may have taken the line meanwhile
+    n = uart_read(uart, buf, len);
+  }
+
+  acquire(&serial_lock);
+  if (subscriber == p)
+    notified = false;
+  release(&serial_lock);
+
+  result_t r = copyout(p->pagetable, addr, buf, n);
+  if (!result_is_ok(r))
+    return r;
+
+  return RESULT_SUCCESS(n);
+}
+
+RESULT_TYPE(void) serial_notify(proc_t *p, g_bool on) {
+  if (!p->mailbox)
+    return RESULT_FAILURE(RESULT_INVALID);
+
+  acquire(&serial_lock);
+  if (on && subscriber && subscriber != p) {
+    release(&serial_lock);
+    return RESULT_FAILURE(RESULT_BUSY);
+  }
+
+  if (on) {
+    subscriber = p;
+    notified = false;
+  } else if (subscriber == p) {
+    subscriber = NULL;
+  }
+  release(&serial_lock);
+
+  return RESULT_SUCCESS(0);
+}
+
+void serial_forget(proc_t *p) {
+  acquire(&serial_lock);
+  if (subscriber == p)
+    subscriber = NULL;
+  release(&serial_lock);
+}
@@ -0,0 +1,41 @@
+#pragma once
+/*
+ * Serial console input for procs.
+ *
+ * The UART's receive ring (see device/uart.h) is read line by line with
+ * SYS_SERIAL_READ, which blocks until a line is complete. A proc that would
+ * rather not block subscribes with SYS_SERIAL_NOTIFY and gets a
+ * NOTIFICATION_TYPE_UART notification in its mailbox (SYS_MAILBOX_RECEIVE)
+ * when input arrives, its value holding the number of readable bytes. The
+ * notification is only a doorbell, the bytes still come through
+ * SYS_SERIAL_READ. At most one is outstanding: the next is posted only
+ * after the subscriber has read.
+ *
+ * Either way input is handed over once per interrupt, however many bytes
+ * the FIFO held.
+ */
+
+#include <lib/result.h>
+#include <lib/types.h>
+
+typedef struct proc proc_t;
+
+/* SYS_SERIAL_READ copies at most this much per call */
+#define SERIAL_READ_MAX 256
+
+/* IRQ handler for the shared UART, registered in place of uart_handle_irq. */
+void serial_handle_irq(void *ctx);
+
+/*
+ * Reads up to `len` bytes of input, at most one line, into user address
+ * `addr` of `p`, the running proc. Blocks until a line is available.
+ * Returns the byte count, 0 if the proc was killed while waiting. Fails with
+ * RESULT_FAULT, consuming nothing, if `addr` is not writable user memory.
+ */
+RESULT_TYPE(uint64_t) serial_read(proc_t *p, uint64_t addr, uint64_t len);
+
+/* Makes `p` the proc notified of input, or stops notifying it. */
+RESULT_TYPE(void) serial_notify(proc_t *p, g_bool on);
+
+/* Drops `p` as the subscriber, called when it exits. */
+void serial_forget(proc_t *p);
@@ -0,0 +1,22 @@
+#include "stats.h"
+#include "irq.h"
+#include "lib/deferred.h"
+#include "lib/intr_trace.h"
+#include "lib/print.h"
+#include "sched.h"
+#include "syscall.h"
+#include "trap_handler.h"
+#include "trap_stats.h"
+
+void stats_print(void) {
+  print("--- kernel statistics ---\n", PRINT_FLAG_BOTH);
+  sched_print_stats();
+  syscall_print_stats();
+  irq_print_stats();
+  deferred_print_stats();
+  trap_stats_print();
+  trap_entry_print_stats();
+#ifdef INTR_TRACE
+  intr_trace_print(INTR_TRACE_DUMP_SITES);
+#endif
+}
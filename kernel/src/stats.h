@@ -0,0 +1,10 @@
+#pragma once
+/*
+ * One dump of the kernel's counters: scheduler, syscalls, interrupt sources,
+ * deferred work, traps and the kernel interrupt entry latency. SYS_STATS
+ * prints it, and the benchmark proc calls that before it exits, so every
+ * boot log ends up with one.
+ */
+
+/* Prints every subsystem's statistics to the console. */
+void stats_print(void);
@@ -0,0 +1,229 @@
+#include "syscall.h"
+#include "bench.h"
+#include "futex.h"
+#include "io_ring.h"
+#include "lib/gfx.h"
+#include "lib/cpu.h"
+#include "lib/gizm_font.h"
+#include "lib/print.h"
+#include "lib/result.h"
+#include "lib/timer.h"
+#include "proc.h"
+#include "serial.h"
+#include "stats.h"
+#include "trap_stats.h"
+
+typedef struct syscall_entry {
+  const char *name;
+  syscall_fn_t fn;
+  uint64_t calls; /* updated atomically, any hart may dispatch */
+  uint64_t ticks; /* time spent in fn, `time` CSR ticks */
+} syscall_entry_t;
+
+static uint64_t enosys_calls;
+
+/* maps a failed result_t to the errno the syscall returns */
+static int64_t result_errno(result_t r) {
+  switch (r.code) {
+  case RESULT_OK:
+    return 0;
+  case RESULT_NOMEM:
+    return -ENOMEM;
+  case RESULT_NOENT:
+  case RESULT_NOT_FOUND:
+    return -ESRCH;
+  case RESULT_INVALID:
+    return -EINVAL;
+  case RESULT_BUSY:
+    return -EBUSY;
+  case RESULT_NOTIMPL:
+    return -ENOSYS;
+  case RESULT_TIMEOUT:
+    return -ETIMEDOUT;
+  case RESULT_FAULT:
+    return -EFAULT;
+  default:
+    return -EINVAL;
+  }
+}
+
+static int64_t sys_exit(proc_t *p, const uint64_t *args) {
+  (void)p;
+  exit(args[0]);
+  return 0; /* not reached */
+}
+
+static int64_t sys_fill_screen(proc_t *p, const uint64_t *args) {
+  (void)p;
+  (void)args;
+  fill_screen_with_color(25, 25, 25);
+  return 0;
+}
+
+static int64_t sys_draw_proc_a(proc_t *p, const uint64_t *args) {
+  (void)p;
+  (void)args;
+  gizm_font_draw_text(20, 20, "Proc A", GIZM_COLOR_BLUE);
+  return 0;
+}
+
+static int64_t sys_draw_proc_b(proc_t *p, const uint64_t *args) {
+  (void)p;
+  (void)args;
+  gizm_font_draw_text(20, 20, "Proc B", GIZM_COLOR_RED);
+  return 0;
+}
+
+static int64_t sys_sched_setaffinity(proc_t *p, const uint64_t *args) {
+  uint64_t pid = args[0] ? args[0] : (uint64_t)p->pid;
+  return result_errno(set_affinity(pid, args[1]));
+}
+
+static int64_t sys_sched_getaffinity(proc_t *p, const uint64_t *args) {
+  uint64_t pid = args[0] ? args[0] : (uint64_t)p->pid;
+  result_t r = get_affinity(pid);
+  if (!result_is_ok(r))
+    return result_errno(r);
+  // only harts that can exist, so the mask never reads as an errno
+  return (int64_t)(result_unwrap(r) & ((1UL << NCPU) - 1));
+}
+
+static int64_t sys_io_ring_setup(proc_t *p, const uint64_t *args) {
+  result_t r = io_ring_setup(p, args[0]);
+  if (!result_is_ok(r))
+    return result_errno(r);
+  return (int64_t)result_unwrap(r);
+}
+
+static int64_t sys_io_ring_enter(proc_t *p, const uint64_t *args) {
+  result_t r = io_ring_enter(p, args[0]);
+  if (!result_is_ok(r))
+    return result_errno(r);
+  return (int64_t)result_unwrap(r);
+}
+
+static int64_t sys_futex_wait(proc_t *p, const uint64_t *args) {
+  result_t r = futex_wait(p, args[0], (uint32_t)args[1], args[2]);
+  // the word changed before we slept: try again in user space
+  if (r.code == RESULT_BUSY)
+    return -EAGAIN;
+  return result_errno(r);
+}
+
+static int64_t sys_futex_wake(proc_t *p, const uint64_t *args) {
+  result_t r = futex_wake(p, args[0], args[1]);
+  if (!result_is_ok(r))
+    return result_errno(r);
+  return (int64_t)result_unwrap(r);
+}
+
+static int64_t sys_null(proc_t *p, const uint64_t *args) {
+  (void)p;
+  (void)args;
+  return 0;
+}
+
+static int64_t sys_getpid(proc_t *p, const uint64_t *args) {
+  (void)args;
+  return p->pid;
+}
+
+static int64_t sys_bench_result(proc_t *p, const uint64_t *args) {
+  (void)p;
+  if (!bench_report(args[0], args[1], args[2], args[3]))
+    return -EINVAL;
+  return 0;
+}
+
+static int64_t sys_trap_stats(proc_t *p, const uint64_t *args) {
+  result_t r = trap_stats_copyout(p, args[0], args[1], args[2]);
+  if (!result_is_ok(r))
+    return result_errno(r);
+  return (int64_t)result_unwrap(r);
+}
+
+static int64_t sys_serial_read(proc_t *p, const uint64_t *args) {
+  result_t r = serial_read(p, args[0], args[1]);
+  if (!result_is_ok(r))
+    return result_errno(r);
+  return (int64_t)result_unwrap(r);
+}
+
+static int64_t sys_serial_notify(proc_t *p, const uint64_t *args) {
+  return result_errno(serial_notify(p, args[0] != 0));
+}
+
+static int64_t sys_mailbox_send(proc_t *p, const uint64_t *args) {
+  return result_errno(proc_send(p, args[0], (uint32_t)args[1]));
+}
+
+static int64_t sys_mailbox_receive(proc_t *p, const uint64_t *args) {
+  return result_errno(mailbox_receive_user(p, args[0]));
+}
+
+static int64_t sys_stats(proc_t *p, const uint64_t *args) {
+  (void)p;
+  (void)args;
+  stats_print();
+  return 0;
+}
+
+static syscall_entry_t syscall_table[NSYSCALLS] = {
+    [SYS_EXIT] = {"exit", sys_exit},
+    [SYS_FILL_SCREEN] = {"fill_screen", sys_fill_screen},
+    [SYS_DRAW_PROC_A] = {"draw_proc_a", sys_draw_proc_a},
+    [SYS_DRAW_PROC_B] = {"draw_proc_b", sys_draw_proc_b},
+    [SYS_SCHED_SETAFFINITY] = {"sched_setaffinity", sys_sched_setaffinity},
+    [SYS_SCHED_GETAFFINITY] = {"sched_getaffinity", sys_sched_getaffinity},
+    [SYS_IO_RING_SETUP] = {"io_ring_setup", sys_io_ring_setup},
+    [SYS_IO_RING_ENTER] = {"io_ring_enter", sys_io_ring_enter},
+    [SYS_FUTEX_WAIT] = {"futex_wait", sys_futex_wait},
+    [SYS_FUTEX_WAKE] = {"futex_wake", sys_futex_wake},
+    [SYS_NULL] = {"null", sys_null},
+    [SYS_GETPID] = {"getpid", sys_getpid},
+    [SYS_BENCH_RESULT] = {"bench_result", sys_bench_result},
+    [SYS_TRAP_STATS] = {"trap_stats", sys_trap_stats},
+    [SYS_SERIAL_READ] = {"serial_read", sys_serial_read},
+    [SYS_SERIAL_NOTIFY] = {"serial_notify", sys_serial_notify},
+    [SYS_MAILBOX_SEND] = {"mailbox_send", sys_mailbox_send},
+    [SYS_MAILBOX_RECEIVE] = {"mailbox_receive", sys_mailbox_receive},
+    [SYS_STATS] = {"stats", sys_stats},
+};
+
+int64_t syscall_invoke(proc_t *p, uint64_t num, const uint64_t *args) {
+  if (num >= NSYSCALLS || !syscall_table[num].fn) {
+    __atomic_fetch_add(&enosys_calls, 1, __ATOMIC_RELAXED);
+    return -ENOSYS;
+  }
+
+  syscall_entry_t *e = &syscall_table[num];
+  __atomic_fetch_add(&e->calls, 1, __ATOMIC_RELAXED);
+
+  uint64_t start = get_csrr_time();
+  int64_t ret = e->fn(p, args);
+  __atomic_fetch_add(&e->ticks, get_csrr_time() - start, __ATOMIC_RELAXED);
+
+  return ret;
+}
+
+void syscall(proc_t *p) {
+  struct trapframe *tf = p->trapframe;
+  uint64_t args[6] = {tf->a0, tf->a1, tf->a2, tf->a3, tf->a4, tf->a5};
+
+  tf->a0 = syscall_invoke(p, tf->a7, args);
+}
+
+void syscall_print_stats(void) {
+  for (int i = 0; i < NSYSCALLS; i++) {
+    syscall_entry_t *e = &syscall_table[i];
+    if (!e->fn || !e->calls)
+      continue;
+
+    printf("syscall %{type: int} %{type: str}: %{type: int} calls, "
+           "%{type: int} ticks each\n",
+           PRINT_FLAG_BOTH, i, e->name, e->calls, e->ticks / e->calls);
+  }
+
+  printf("syscall: %{type: int} calls to unknown numbers\n", PRINT_FLAG_BOTH,
+         enosys_calls);
+}
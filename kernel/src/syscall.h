@@ -1,2 +1,67 @@
 #pragma once
+/*
+ * System call ABI.
+ *
+ * The syscall number goes in a7 and up to six arguments in a0-a5. The result
+ * comes back in a0: zero or a positive value on success, a negated errno on
+ * failure. A number without a handler returns -ENOSYS.
+ *
+ * Included from user_bench.S, so only macros outside __ASSEMBLER__.
+ */
 
+/* syscall numbers, passed in a7 */
+#define SYS_EXIT 2               /* a0 = status, does not return */
+#define SYS_FILL_SCREEN 6        /* clears the framebuffer */
+#define SYS_DRAW_PROC_A 7        /* demo: draws "Proc A" */
+#define SYS_DRAW_PROC_B 8        /* demo: draws "Proc B" */
+#define SYS_SCHED_SETAFFINITY 9  /* a0 = pid (0 = self), a1 = hart mask */
+#define SYS_SCHED_GETAFFINITY 10 /* a0 = pid (0 = self), returns the mask */
+#define SYS_IO_RING_SETUP 11     /* a0 = IO_RING_* flags, returns the address */
+#define SYS_IO_RING_ENTER 12     /* a0 = max SQEs to submit, see io_ring.h */
+#define SYS_FUTEX_WAIT 13        /* a0 = addr, a1 = val, a2 = timeout us */
+#define SYS_FUTEX_WAKE 14        /* a0 = addr, a1 = max waiters, see futex.h */
+#define SYS_NULL 15              /* does nothing, for timing the trap path */
+#define SYS_GETPID 16            /* returns the caller's pid */
+#define SYS_BENCH_RESULT 17      /* a0 = id, a1 = iters, a2 = total, a3 = min */
+#define SYS_TRAP_STATS 18        /* a0 = TRAP_STATS_*, a1 = buf, a2 = len */
+#define SYS_SERIAL_READ 19       /* a0 = buf, a1 = len, returns bytes read */
+#define SYS_SERIAL_NOTIFY 20     /* a0 = 1 to get input notifications, 0 not */
+#define SYS_MAILBOX_SEND 21      /* a0 = pid, a1 = 32-bit value */
+#define SYS_MAILBOX_RECEIVE 22   /* a0 = mailbox_msg_t buf, blocks */
+#define SYS_STATS 23             /* prints the kernel statistics, see stats.h */
+
+#define NSYSCALLS 24
+
+/* errno values returned (negated) in a0 */
+#define ESRCH 3
+#define EAGAIN 11
+#define ENOMEM 12
+#define EFAULT 14
+#define EBUSY 16
+#define EINVAL 22
+#define ENOSYS 38
+#define ETIMEDOUT 110
+
+#ifndef __ASSEMBLER__
+
+#include <lib/types.h>
+
+typedef struct proc proc_t;
+
+/*
+ * A handler gets a0-a5 in args[0..5] and returns the value for a0. `p` is
+ * the proc the call is made for, which is not the running proc when an
+ * io_ring poller submits it.
+ */
+typedef int64_t (*syscall_fn_t)(proc_t *p, const uint64_t *args);
+
+/* Runs the system call in p's trapframe and stores the result in its a0. */
+void syscall(proc_t *p);
+
+/* Runs syscall `num` for `p` and returns its result, -ENOSYS if unknown. */
+int64_t syscall_invoke(proc_t *p, uint64_t num, const uint64_t *args);
+
+/* Prints how often each syscall ran and its average cost in timer ticks. */
+void syscall_print_stats(void);
+
+#endif
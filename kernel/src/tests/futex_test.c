@@ -0,0 +1,290 @@
+#include "test.h"
+#include <futex.h>
+#include <lib/cpu.h>
+#include <lib/memory.h>
+#include <lib/print.h>
+#include <lib/result.h>
+#include <lib/time.h>
+#include <lib/timer.h>
+#include <page_table.h>
+#include <physical_alloc.h>
+#include <proc.h>
+#include <stdbool.h>
+
+/*
+ * Futex words live in a page table of their own: a user page at WORD_VA and
+ * a kernel-only page at KERNEL_VA. futex_wait/futex_wake only look addresses
+ * up in p->pagetable, so the procs here point it at that table while the
+ * kernel keeps running on its own satp.
+ *
+ * The checks that cannot sleep run before the scheduler on a bare proc_t.
+ * The rest run in a kernel task, with more kernel tasks as the waiters.
+ */
+
+#define WORD_VA 0x10000
+#define KERNEL_VA (WORD_VA + PAGE_SIZE)
+#define WAITERS 3
+#define TIMEOUT_US 1000
+#define WAKE_DELAY_MS 5
+#define SPIN_LIMIT 1000 /* polls of 100us before giving up on a waiter */
+
+static page_table_t *table;
+static void *word_page;
+static void *kernel_page;
+
+static volatile uint32_t *word(void) { return (volatile uint32_t *)word_page; }
+
+static bool setup(void) {
+  table = create_page_table();
+  word_page = alloc_page();
+  kernel_page = alloc_page();
+  if (!table || !word_page || !kernel_page)
+    return false;
+
+  memset(word_page, 0, PAGE_SIZE);
+  return map_page(table, WORD_VA, V2P((uint64_t)word_page),
+                  PTE_R | PTE_W | PTE_U | PTE_V) &&
+         map_page(table, KERNEL_VA, V2P((uint64_t)kernel_page),
+                  PTE_R | PTE_W | PTE_V);
+}
+
+static void teardown(void) {
+  if (table) {
+    unmap_page(table, WORD_VA);
+    unmap_page(table, KERNEL_VA);
+    free_page_table(table);
+  }
+  if (word_page)
+    free_page(word_page);
+  if (kernel_page)
+    free_page(kernel_page);
+  table = NULL;
+  word_page = kernel_page = NULL;
+}
+
+// Waking checks the address and counts only real waiters
+static bool test_wake() {
+  proc_t outsider;
+  bool ok = true;
+
+  if (!setup()) {
+    teardown();
+    return false;
+  }
+  memset(&outsider, 0, sizeof(outsider));
+  outsider.pagetable = table;
+
+  result_t r = futex_wake(&outsider, WORD_VA, 1);
+  ok = result_is_ok(r) && result_unwrap(r) == 0;
+  ok = ok && futex_wake(&outsider, WORD_VA + 2, 1).code == RESULT_INVALID;
+  ok = ok && futex_wake(&outsider, 0, 1).code == RESULT_INVALID;
+
+  teardown();
+  return ok;
+}
+
+// Kernel-only pages are no futex words
+static bool test_kernel_page() {
+  proc_t outsider;
+  bool ok = true;
+
+  if (!setup()) {
+    teardown();
+    return false;
+  }
+  memset(&outsider, 0, sizeof(outsider));
+  outsider.pagetable = table;
+
+  ok = futex_wake(&outsider, KERNEL_VA, 1).code == RESULT_INVALID;
+
+  teardown();
+  return ok;
+}
+
+// Only the proc itself may wait on its words
+static bool test_wait_not_current() {
+  proc_t outsider;
+  bool ok = true;
+
+  if (!setup()) {
+    teardown();
+    return false;
+  }
+  memset(&outsider, 0, sizeof(outsider));
+  outsider.pagetable = table;
+
+  ok = futex_wait(&outsider, WORD_VA, 0, 0).code == RESULT_INVALID;
+
+  teardown();
+  return ok;
+}
+
+bool run_futex_tests() {
+  bool wake_test = test_wake();
+  test_complete("futex wake", wake_test);
+
+  bool kernel_page_test = test_kernel_page();
+  test_complete("futex on a kernel page", kernel_page_test);
+
+  bool wait_test = test_wait_not_current();
+  test_complete("futex wait from another proc", wait_test);
+
+  return wake_test && kernel_page_test && wait_test;
+}
+
+static proc_t *waiters[WAITERS];
+static uint32_t woken;
+
+static void waiter(void *arg) {
+  (void)arg;
+  proc_t *p = current_proc();
+
+  p->pagetable = table;
+  futex_wait(p, WORD_VA, 0, 0);
+  p->pagetable = shared_page_table;
+
+  __atomic_fetch_add(&woken, 1, __ATOMIC_RELEASE);
+}
+
+static bool sleeping(proc_t *p) {
+  acquire(&p->lock);
+  bool s = p->state == SLEEPING;
+  release(&p->lock);
+  return s;
+}
+
+/* polls until `n` waiters returned from futex_wait */
+static bool wait_woken(uint32_t n) {
+  for (int i = 0; i < SPIN_LIMIT; i++) {
+    if (__atomic_load_n(&woken, __ATOMIC_ACQUIRE) >= n)
+      return true;
+    sleep_us(100);
+  }
+  return false;
+}
+
+// A word that no longer holds the value does not sleep
+static bool test_wait_changed(proc_t *self) {
+  *word() = 1;
+  bool ok = futex_wait(self, WORD_VA, 0, 0).code == RESULT_BUSY;
+  *word() = 0;
+  return ok;
+}
+
+// Nobody wakes the word, so the wait ends at the timeout
+static bool test_wait_timeout(proc_t *self) {
+  uint64_t start = get_csrr_time();
+  result_t r = futex_wait(self, WORD_VA, 0, TIMEOUT_US);
+  uint64_t elapsed = get_csrr_time() - start;
+
+  return r.code == RESULT_TIMEOUT && elapsed >= timer_us_to_ticks(TIMEOUT_US);
+}
+
+static void delayed_waker(void *arg) {
+  proc_t *self = current_proc();
+
+  sleep_ms(WAKE_DELAY_MS);
+  self->pagetable = table;
+  futex_wake(self, WORD_VA, 1);
+  self->pagetable = shared_page_table;
+
+  __atomic_store_n((uint32_t *)arg, 1, __ATOMIC_RELEASE);
+}
+
+// A timeout too long to represent waits for the wake instead of wrapping
+// around into a deadline that already passed
+static bool test_wait_huge_timeout(proc_t *self) {
+  static uint32_t waker_done;
+  waker_done = 0;
+
+  if (!result_is_ok(make_kernel_task(delayed_waker, &waker_done, "futexwk")))
+    return false;
+
+  uint64_t start = get_csrr_time();
+  result_t r = futex_wait(self, WORD_VA, 0, UINT64_MAX);
+  uint64_t elapsed = get_csrr_time() - start;
+
+  // the waker still uses the table until it says it is done
+  bool done = false;
+  for (int i = 0; i < SPIN_LIMIT && !done; i++) {
+    done = __atomic_load_n(&waker_done, __ATOMIC_ACQUIRE);
+    if (!done)
+      sleep_us(100);
+  }
+
+  return result_is_ok(r) && done &&
+         elapsed >= timer_us_to_ticks(WAKE_DELAY_MS * 1000);
+}
+
+// futex_wake(n) wakes exactly n of the sleepers, the rest keep sleeping
+static bool test_wake_n(proc_t *self) {
+  woken = 0;
+
+  for (int i = 0; i < WAITERS; i++) {
+    result_t r = make_kernel_task(waiter, NULL, "futexw");
+    if (!result_is_ok(r))
+      return false;
+    waiters[i] = (proc_t *)result_unwrap(r);
+  }
+
+  // none can return before a wake, so the procs stay valid until then
+  for (int i = 0; i < WAITERS; i++) {
+    int spins = 0;
+    while (!sleeping(waiters[i])) {
+      if (++spins > SPIN_LIMIT)
+        return false;
+      sleep_us(100);
+    }
+  }
+
+  result_t r = futex_wake(self, WORD_VA, WAITERS - 1);
+  if (!result_is_ok(r) || result_unwrap(r) != WAITERS - 1)
+    return false;
+  if (!wait_woken(WAITERS - 1))
+    return false;
+
+  // the last one must still be asleep
+  sleep_ms(5);
+  if (__atomic_load_n(&woken, __ATOMIC_ACQUIRE) != WAITERS - 1)
+    return false;
+
+  r = futex_wake(self, WORD_VA, WAITERS);
+  if (!result_is_ok(r) || result_unwrap(r) != 1)
+    return false;
+
+  return wait_woken(WAITERS);
+}
+
+static void futex_wait_tests(void *arg) {
+  (void)arg;
+  proc_t *self = current_proc();
+
+  if (!setup())
+    panic("futex wait tests: setup failed");
+  self->pagetable = table;
+
+  bool changed_test = test_wait_changed(self);
+  test_complete("futex wait on a changed word", changed_test);
+
+  bool timeout_test = test_wait_timeout(self);
+  test_complete("futex wait timeout", timeout_test);
+
+  bool huge_timeout_test = test_wait_huge_timeout(self);
+  test_complete("futex wait with a huge timeout", huge_timeout_test);
+
+  bool wake_n_test = test_wake_n(self);
+  test_complete("futex wake of n waiters", wake_n_test);
+
+  self->pagetable = shared_page_table;
+  // a waiter left behind would still have the table in use
+  if (wake_n_test && huge_timeout_test)
+    teardown();
+
+  if (!changed_test || !timeout_test || !huge_timeout_test || !wake_n_test)
+    panic("futex wait tests failed");
+  print("futex wait tests passed\n", PRINT_FLAG_BOTH);
+}
+
+bool start_futex_wait_tests() {
+  return result_is_ok(make_kernel_task(futex_wait_tests, NULL, "futextest"));
+}
@@ -0,0 +1,14 @@
+#ifndef FUTEX_TEST_H
+#define FUTEX_TEST_H
+
+#include <stdbool.h>
+
+bool run_futex_tests(void);
+
+/*
+ * Starts a kernel task running the tests that sleep, once the scheduler
+ * runs. It panics if one fails.
+ */
+bool start_futex_wait_tests(void);
+
+#endif /* FUTEX_TEST_H */
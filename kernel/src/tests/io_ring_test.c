@@ -0,0 +1,120 @@
+#include "test.h"
+#include <io_ring.h>
+#include <lib/cpu.h>
+#include <lib/print.h>
+#include <lib/result.h>
+#include <proc.h>
+#include <stdbool.h>
+#include <syscall.h>
+
+/*
+ * The rings are driven from the kernel side: SQEs are written through the
+ * kernel mapping of the shared pages, exactly as the proc would through
+ * IO_RING_BASE, and io_ring_enter() is called directly.
+ */
+
+#define ENOSYS_OPCODE (NSYSCALLS + 1)
+
+static proc_t *owner;
+static io_ring_t *ring;
+
+static bool setup(void) {
+  result_t r = make_proc();
+  if (!result_is_ok(r))
+    return false;
+  owner = (proc_t *)result_unwrap(r);
+  release(&owner->lock);
+
+  if (!result_is_ok(io_ring_setup(owner, 0)))
+    return false;
+  ring = owner->io_ring;
+  return true;
+}
+
+static void teardown(void) {
+  io_ring_destroy(owner);
+  acquire(&owner->lock);
+  free_process(owner);
+  release(&owner->lock);
+}
+
+static void queue(uint64_t opcode, uint64_t user_data, uint64_t a0) {
+  io_ring_shared_t *sh = ring->shared;
+  io_sqe_t *sqe = &ring->sqes[sh->sq_tail % IO_RING_SQ_ENTRIES];
+
+  sqe->opcode = opcode;
+  sqe->user_data = user_data;
+  sqe->args[0] = a0;
+  __atomic_store_n(&sh->sq_tail, sh->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t enter(uint64_t to_submit) {
+  return result_unwrap(io_ring_enter(owner, to_submit));
+}
+
+static bool check_cqe(uint32_t index, uint64_t user_data, int64_t res) {
+  io_cqe_t *cqe = &ring->shared->cqes[index % IO_RING_CQ_ENTRIES];
+  if (cqe->user_data == user_data && cqe->res == res)
+    return true;
+
+  printf("cqe %{type: int}: user_data %{type: int} res %{type: int}, "
+         "expected %{type: int} and %{type: int}\n",
+         PRINT_FLAG_BOTH, index, cqe->user_data, cqe->res, user_data, res);
+  return false;
+}
+
+// One enter runs the whole batch in order, refusing what a ring can't run
+static bool test_batch() {
+  bool ok = true;
+
+  if (!setup())
+    return false;
+
+  queue(SYS_SCHED_GETAFFINITY, 1, 0);
+  queue(ENOSYS_OPCODE, 2, 0);
+  queue(SYS_EXIT, 3, 0);
+
+  ok = enter(8) == 3;
+  ok = ok && ring->shared->cq_tail == 3 && ring->shared->sq_head == 3;
+  ok = ok && check_cqe(0, 1, (1L << NCPU) - 1);
+  ok = ok && check_cqe(1, 2, -ENOSYS);
+  ok = ok && check_cqe(2, 3, -EINVAL);
+  ok = ok && result_is_ok(io_ring_setup(owner, 0)) == false;
+
+  teardown();
+  return ok;
+}
+
+// Submission stops while the completion queue is full
+static bool test_cq_full() {
+  bool ok = true;
+
+  if (!setup())
+    return false;
+
+  for (int i = 0; i < IO_RING_CQ_ENTRIES / IO_RING_SQ_ENTRIES; i++) {
+    for (int j = 0; j < IO_RING_SQ_ENTRIES; j++)
+      queue(ENOSYS_OPCODE, j, 0);
+    ok = ok && enter(IO_RING_SQ_ENTRIES) == IO_RING_SQ_ENTRIES;
+  }
+
+  queue(ENOSYS_OPCODE, 42, 0);
+  ok = ok && enter(1) == 0;
+
+  __atomic_store_n(&ring->shared->cq_head, 1, __ATOMIC_RELEASE);
+  ok = ok && enter(1) == 1;
+  ok = ok && check_cqe(IO_RING_CQ_ENTRIES, 42, -ENOSYS);
+
+  teardown();
+  return ok;
+}
+
+bool run_io_ring_tests() {
+  bool batch_test = test_batch();
+  test_complete("io_ring batch", batch_test);
+
+  bool full_test = test_cq_full();
+  test_complete("io_ring full completion queue", full_test);
+
+  return batch_test && full_test;
+}
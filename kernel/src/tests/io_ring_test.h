@@ -0,0 +1,8 @@
+#ifndef IO_RING_TEST_H
+#define IO_RING_TEST_H
+
+#include <stdbool.h>
+
+bool run_io_ring_tests(void);
+
+#endif /* IO_RING_TEST_H */
@@ -0,0 +1,96 @@
+#include "test.h"
+#include <lib/cpu.h>
+#include <lib/mailbox.h>
+#include <lib/print.h>
+#include <lib/result.h>
+#include <lib/timer.h>
+#include <proc.h>
+#include <stdbool.h>
+
+/*
+ * Request/response over mailboxes between two kernel tasks, the way
+ * SYS_MAILBOX_SEND and SYS_MAILBOX_RECEIVE do it for user procs: the client
+ * sends a value with proc_send(), the server sends it back plus one. Each
+ * send should hand the hart straight to the other task through yield_to(),
+ * so a round trip is two handoffs and no pass through the scheduler.
+ */
+
+#define ROUND_TRIPS 256
+#define STOP 0 /* value that ends the server */
+
+static void echo_server(void *arg) {
+  (void)arg;
+  proc_t *self = current_proc();
+  notification_t n;
+
+  while (mailbox_receive(self->mailbox, &n)) {
+    if (n.value == STOP)
+      return;
+    proc_send(self, n.sender, n.value + 1);
+  }
+}
+
+/* handoffs done by this hart so far */
+static uint64_t handoffs(void) {
+  intr_push_off();
+  uint64_t h = current_cpu()->handoffs;
+  intr_pop_off();
+  return h;
+}
+
+// Every send is a direct switch and the replies arrive in order
+static bool test_round_trip(proc_t *self, int server) {
+  notification_t n;
+
+  uint64_t first_handoffs = handoffs();
+  uint64_t start = get_time_in_cycles();
+
+  for (uint32_t i = 1; i <= ROUND_TRIPS; i++) {
+    if (!result_is_ok(proc_send(self, server, i)))
+      return false;
+    if (!mailbox_receive(self->mailbox, &n))
+      return false;
+    if (n.type != NOTIFICATION_TYPE_GIZMO || n.sender != server ||
+        n.value != i + 1)
+      return false;
+  }
+
+  uint64_t cycles = get_time_in_cycles() - start;
+  uint64_t switches = handoffs() - first_handoffs;
+
+  printf("mailbox round trip: %{type: int} cycles, %{type: int} handoffs "
+         "for %{type: int} round trips\n",
+         PRINT_FLAG_BOTH, cycles / ROUND_TRIPS, switches, ROUND_TRIPS);
+
+  return switches == 2 * ROUND_TRIPS;
+}
+
+static void mailbox_tests(void *arg) {
+  (void)arg;
+  proc_t *self = current_proc();
+
+  // both pinned to this hart, where the handoffs are counted
+  kernel_task_opts_t opts = {
+      .priority = PROC_PRIORITY_HIGH,
+      .affinity = 1ULL << cpu_id(current_cpu()),
+  };
+  set_affinity(0, opts.affinity);
+
+  result_t r = make_kernel_task_opts(echo_server, NULL, "echod", &opts);
+  if (!result_is_ok(r))
+    panic("mailbox tests: no server");
+  int server = ((proc_t *)result_unwrap(r))->pid;
+
+  bool round_trip_test = test_round_trip(self, server);
+  test_complete("mailbox round trip", round_trip_test);
+
+  proc_send(self, server, STOP);
+
+  if (!round_trip_test)
+    panic("mailbox tests failed");
+  print("mailbox tests passed\n", PRINT_FLAG_BOTH);
+}
+
+bool start_mailbox_tests() {
+  return result_is_ok(make_kernel_task(mailbox_tests, NULL, "mailboxtest"));
+}
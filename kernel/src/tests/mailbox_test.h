@@ -0,0 +1,12 @@
+#ifndef MAILBOX_TEST_H
+#define MAILBOX_TEST_H
+
+#include <stdbool.h>
+
+/*
+ * Starts a kernel task timing mailbox round trips between two tasks, once
+ * the scheduler runs. It panics if one is not a direct handoff.
+ */
+bool start_mailbox_tests(void);
+
+#endif /* MAILBOX_TEST_H */
@@ -0,0 +1,94 @@
+#include "test.h"
+#include <lib/print.h>
+#include <lib/result.h>
+#include <lib/timer.h>
+#include <physical_alloc.h>
+#include <proc.h>
+#include <stdbool.h>
+
+/*
+ * Spawn/exit without the scheduler: make_proc() followed by free_process(),
+ * which is what fork() and wait() do around the program itself.
+ */
+
+#define BATCH PROC_SHELL_CACHE_MAX
+#define ROUNDS 64
+
+static proc_t *batch[BATCH];
+
+static bool spawn_batch(void) {
+  for (int i = 0; i < BATCH; i++) {
+    result_t r = make_proc();
+    if (!result_is_ok(r))
+      return false;
+    batch[i] = (proc_t *)result_unwrap(r);
+    release(&batch[i]->lock);
+  }
+  return true;
+}
+
+static void exit_batch(void) {
+  for (int i = 0; i < BATCH; i++) {
+    acquire(&batch[i]->lock);
+    free_process(batch[i]);
+    release(&batch[i]->lock);
+  }
+}
+
+/* ticks per spawn/exit pair over one batch */
+static uint64_t time_batch(void) {
+  uint64_t start = get_csrr_time();
+  if (!spawn_batch())
+    return 0;
+  exit_batch();
+  return (get_csrr_time() - start) / BATCH;
+}
+
+// A recycled proc reuses its shell instead of allocating pages
+static bool test_shell_recycling() {
+  if (!time_batch())
+    return false;
+
+  uint64_t free_pages = get_free_page_count();
+  for (int i = 0; i < ROUNDS; i++) {
+    if (!time_batch())
+      return false;
+  }
+
+  if (get_free_page_count() != free_pages) {
+    printf("spawn/exit leaked %{type: int} pages\n", PRINT_FLAG_BOTH,
+           free_pages - get_free_page_count());
+    return false;
+  }
+
+  return true;
+}
+
+// Reports spawn/exit cost with and without cached shells
+static bool bench_spawn_exit() {
+  // the first batch after boot builds every shell, unless a test ran first
+  uint64_t cold = time_batch();
+  uint64_t warm = 0;
+
+  for (int i = 0; i < ROUNDS; i++)
+    warm += time_batch();
+  warm /= ROUNDS;
+
+  if (!cold || !warm)
+    return false;
+
+  printf("spawn/exit: %{type: int} ticks cold, %{type: int} ticks warm, "
+         "%{type: int} per second\n",
+         PRINT_FLAG_BOTH, cold, warm, TIMER_FREQUENCY / warm);
+  return true;
+}
+
+bool run_proc_tests() {
+  bool bench = bench_spawn_exit();
+  test_complete("spawn/exit benchmark", bench);
+
+  bool recycling_test = test_shell_recycling();
+  test_complete("proc shell recycling", recycling_test);
+
+  return bench && recycling_test;
+}
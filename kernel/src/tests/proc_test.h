@@ -0,0 +1,8 @@
+#ifndef PROC_TEST_H
+#define PROC_TEST_H
+
+#include <stdbool.h>
+
+bool run_proc_tests(void);
+
+#endif /* PROC_TEST_H */
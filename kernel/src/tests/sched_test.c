@@ -0,0 +1,177 @@
+#include "test.h"
+#include <lib/memory.h>
+#include <lib/print.h>
+#include <proc.h>
+#include <sched.h>
+#include <stdbool.h>
+
+/*
+ * The run queue is driven directly, without timers or context switches: each
+ * round picks the next proc, "runs" it for its full timeslice and queues it
+ * again, exactly like a hart whose procs never block.
+ */
+
+#define MAX_TEST_TASKS 16
+#define SIM_TICKS (SCHED_LATENCY_TICKS * 500) /* 10s at 10MHz */
+#define SHARE_TOLERANCE 10                    /* per mille */
+
+static proc_t tasks[MAX_TEST_TASKS];
+static runqueue_t rq;
+
+static bool setup(const uint8_t *priorities, int n) {
+  if (!runqueue_init(&rq))
+    return false;
+
+  for (int i = 0; i < n; i++) {
+    memset(&tasks[i], 0, sizeof(proc_t));
+    tasks[i].priority = priorities[i];
+    runqueue_enqueue(&rq, &tasks[i]);
+  }
+
+  return true;
+}
+
+static void teardown(void) {
+  while (runqueue_pick(&rq))
+    ;
+  heap_destroy(&rq.tasks);
+}
+
+static void simulate(uint64_t ticks, uint64_t *runtime) {
+  uint64_t elapsed = 0;
+
+  while (elapsed < ticks) {
+    proc_t *p = runqueue_pick(&rq);
+    uint64_t slice = runqueue_slice(&rq, p);
+
+    runtime[p - tasks] += slice;
+    runqueue_charge(&rq, p, slice);
+    runqueue_enqueue(&rq, p);
+    elapsed += slice;
+  }
+}
+
+/* checks every task got its weighted share of the total runtime */
+static bool check_shares(const uint8_t *priorities, int n, uint64_t *runtime) {
+  uint64_t total_runtime = 0;
+  uint64_t total_weight = 0;
+
+  for (int i = 0; i < n; i++) {
+    total_runtime += runtime[i];
+    total_weight += sched_weight(priorities[i]);
+  }
+
+  for (int i = 0; i < n; i++) {
+    int64_t share = runtime[i] * 1000 / total_runtime;
+    int64_t expected = sched_weight(priorities[i]) * 1000 / total_weight;
+    if (share < expected - SHARE_TOLERANCE ||
+        share > expected + SHARE_TOLERANCE) {
+      printf("task %{type: int}: %{type: int} per mille of CPU, expected "
+             "%{type: int}\n",
+             PRINT_FLAG_BOTH, i, share, expected);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool run_shares_test(const uint8_t *priorities, int n) {
+  uint64_t runtime[MAX_TEST_TASKS] = {0};
+
+  if (!setup(priorities, n))
+    return false;
+
+  simulate(SIM_TICKS, runtime);
+  bool ok = check_shares(priorities, n, runtime);
+
+  teardown();
+  return ok;
+}
+
+// Equal priorities split the CPU evenly
+static bool test_equal_shares() {
+  const uint8_t prios[] = {PROC_PRIORITY_NORMAL, PROC_PRIORITY_NORMAL};
+  return run_shares_test(prios, 2);
+}
+
+// A busy high priority task no longer starves the others
+static bool test_weighted_shares() {
+  const uint8_t prios[] = {PROC_PRIORITY_HIGH, PROC_PRIORITY_NORMAL,
+                           PROC_PRIORITY_NORMAL + 1, PROC_PRIORITY_LOW};
+  return run_shares_test(prios, 4);
+}
+
+// A task that joins late starts at min_vruntime instead of 0
+static bool test_late_arrival() {
+  const uint8_t prios[] = {PROC_PRIORITY_NORMAL, PROC_PRIORITY_NORMAL,
+                           PROC_PRIORITY_NORMAL};
+  uint64_t runtime[MAX_TEST_TASKS] = {0};
+  bool ok = true;
+
+  if (!setup(prios, 2))
+    return false;
+  simulate(SIM_TICKS, runtime);
+
+  memset(&tasks[2], 0, sizeof(proc_t));
+  tasks[2].priority = prios[2];
+  runqueue_enqueue(&rq, &tasks[2]);
+  if (tasks[2].vruntime < rq.min_vruntime) {
+    print("late task queued below min_vruntime\n", PRINT_FLAG_BOTH);
+    ok = false;
+  }
+
+  memset(runtime, 0, sizeof(runtime));
+  simulate(SIM_TICKS, runtime);
+  ok = ok && check_shares(prios, 3, runtime);
+
+  teardown();
+  return ok;
+}
+
+// Timeslices shrink with the load but never below the minimum granularity
+static bool test_min_granularity() {
+  uint8_t prios[MAX_TEST_TASKS];
+  uint64_t saved = sched_min_granularity();
+  bool ok = true;
+
+  for (int i = 0; i < MAX_TEST_TASKS; i++)
+    prios[i] = PROC_PRIORITY_NORMAL;
+  if (!setup(prios, MAX_TEST_TASKS))
+    return false;
+
+  proc_t *p = runqueue_pick(&rq);
+  uint64_t fair = SCHED_LATENCY_TICKS / MAX_TEST_TASKS;
+
+  sched_set_min_granularity(fair * 2);
+  if (runqueue_slice(&rq, p) != fair * 2) {
+    print("slice below minimum granularity\n", PRINT_FLAG_BOTH);
+    ok = false;
+  }
+
+  sched_set_min_granularity(fair / 2);
+  if (runqueue_slice(&rq, p) != fair) {
+    print("slice not split by weight\n", PRINT_FLAG_BOTH);
+    ok = false;
+  }
+
+  sched_set_min_granularity(saved);
+  teardown();
+  return ok;
+}
+
+bool run_sched_tests() {
+  bool equal_test = test_equal_shares();
+  test_complete("equal cpu shares", equal_test);
+
+  bool weighted_test = test_weighted_shares();
+  test_complete("weighted cpu shares", weighted_test);
+
+  bool late_test = test_late_arrival();
+  test_complete("late arrival", late_test);
+
+  bool granularity_test = test_min_granularity();
+  test_complete("minimum granularity", granularity_test);
+
+  return equal_test && weighted_test && late_test && granularity_test;
+}
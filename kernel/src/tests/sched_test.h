@@ -0,0 +1,8 @@
+#ifndef SCHED_TEST_H
+#define SCHED_TEST_H
+
+#include <stdbool.h>
+
+bool run_sched_tests(void);
+
+#endif /* SCHED_TEST_H */
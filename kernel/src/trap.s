@@ -1,29 +1,51 @@
-    .section .bss
-    .align 16
-    .global trap_stack_bottom
-    .global trap_stack_top
-trap_stack_bottom:
-    .skip 8192
-trap_stack_top:
+# Kernel trap vectors.
+#
+# Traps taken in S-mode are handled on the stack that was in use when the
+# trap happened: the running proc's kernel stack, or the boot stack while in
+# scheduler(). Since a kernel trap may switch procs (see kernel_preempt()),
+# sepc and sstatus are saved in the frame as well, and tp is not restored in
+# case the proc resumes on another hart.
+#
+# Exceptions are the exception: they are fatal in S-mode, and the stack in
+# use may be the one that overflowed into its guard page, where saving the
+# frame would fault again and again. They switch to this hart's exception
+# stack (exception_stack_tops[tp], see trap_init()) before the first store,
+# keeping the interrupted sp in the frame for exception_handler() to report.
+#
+# stvec is in vectored mode (see kernel_trap_vector()): exceptions enter
+# trap_vector, which saves every register, while the timer, software and
+# external interrupts get stubs that save only the caller-saved ones. The C
+# handlers preserve s0-s11 themselves, also across a switch in
+# kernel_preempt(), since swtch() saves them. Each entry records the cycle
+# counter on arrival so the handler can account its entry latency.
+#
+# Building with TRAP_VECTOR_DIRECT puts stvec back in direct mode, every trap
+# taking the full save, for comparing the two.
 
     .section .text
     .global trap_vector
+    .global trap_vector_table
     .align 4
 
-.macro switch_to_trap_stack
-    mv t0, sp
-    la sp, trap_stack_top
-    csrw sscratch, t0
-.endm
+# full frame: 32 registers, sepc, sstatus, entry cycle count, interrupted sp
+.equ FULL_FRAME, 272
+.equ FULL_SEPC, 240
+.equ FULL_SSTATUS, 248
+.equ FULL_CYCLES, 256
+.equ FULL_SP, 264
 
-.macro restore_caller_stack
-    csrr sp, sscratch
-.endm
+# caller-saved frame
+.equ FAST_FRAME, 160
+.equ FAST_SEPC, 128
+.equ FAST_SSTATUS, 136
+.equ FAST_CYCLES, 144
 
 .macro save_regs
-    addi sp, sp, -256
-    sd ra,   0(sp)
+    addi sp, sp, -FULL_FRAME
     sd t0,   8(sp)
+    rdcycle t0
+    sd t0, FULL_CYCLES(sp)
+    sd ra,   0(sp)
     sd t1,  16(sp)
     sd t2,  24(sp)
     sd s0,  32(sp)
@@ -52,9 +74,17 @@ trap_stack_top:
     sd t6, 216(sp)
     sd tp, 224(sp)
     sd gp, 232(sp)
+    csrr t0, sepc
+    sd t0, FULL_SEPC(sp)
+    csrr t0, sstatus
+    sd t0, FULL_SSTATUS(sp)
 .endm
 
 .macro restore_regs
+    ld t0, FULL_SEPC(sp)
+    csrw sepc, t0
+    ld t0, FULL_SSTATUS(sp)
+    csrw sstatus, t0
     ld ra,   0(sp)
     ld t0,   8(sp)
     ld t1,  16(sp)
@@ -83,29 +113,142 @@ trap_stack_top:
     ld t4, 200(sp)
     ld t5, 208(sp)
     ld t6, 216(sp)
-    ld tp, 224(sp)
+    # not tp, see above
     ld gp, 232(sp)
-    addi sp, sp, 256
+    addi sp, sp, FULL_FRAME
+.endm
+
+.macro save_caller_regs
+    addi sp, sp, -FAST_FRAME
+    sd t0,   8(sp)
+    rdcycle t0
+    sd t0, FAST_CYCLES(sp)
+    sd ra,   0(sp)
+    sd t1,  16(sp)
+    sd t2,  24(sp)
+    sd a0,  32(sp)
+    sd a1,  40(sp)
+    sd a2,  48(sp)
+    sd a3,  56(sp)
+    sd a4,  64(sp)
+    sd a5,  72(sp)
+    sd a6,  80(sp)
+    sd a7,  88(sp)
+    sd t3,  96(sp)
+    sd t4, 104(sp)
+    sd t5, 112(sp)
+    sd t6, 120(sp)
+    csrr t0, sepc
+    sd t0, FAST_SEPC(sp)
+    csrr t0, sstatus
+    sd t0, FAST_SSTATUS(sp)
+.endm
+
+.macro restore_caller_regs
+    ld t0, FAST_SEPC(sp)
+    csrw sepc, t0
+    ld t0, FAST_SSTATUS(sp)
+    csrw sstatus, t0
+    ld ra,   0(sp)
+    ld t0,   8(sp)
+    ld t1,  16(sp)
+    ld t2,  24(sp)
+    ld a0,  32(sp)
+    ld a1,  40(sp)
+    ld a2,  48(sp)
+    ld a3,  56(sp)
+    ld a4,  64(sp)
+    ld a5,  72(sp)
+    ld a6,  80(sp)
+    ld a7,  88(sp)
+    ld t3,  96(sp)
+    ld t4, 104(sp)
+    ld t5, 112(sp)
+    ld t6, 120(sp)
+    addi sp, sp, FAST_FRAME
+.endm
+
+# handler(sstatus at entry, entry cycle count)
+.macro fast_entry handler
+    .cfi_startproc
+    .cfi_signal_frame
+    save_caller_regs
+    .cfi_def_cfa sp, FAST_FRAME
+    .cfi_offset ra, -FAST_FRAME
+    ld a0, FAST_SSTATUS(sp)
+    ld a1, FAST_CYCLES(sp)
+    call \handler
+    restore_caller_regs
+    .cfi_def_cfa sp, 0
+    .cfi_endproc
+    sret
 .endm
 
 trap_vector:
     .cfi_startproc
     .cfi_signal_frame
-    switch_to_trap_stack
-    .cfi_def_cfa_register t0
+    csrw sscratch, t0
+    csrr t0, scause
+    bltz t0, 1f             # interrupts stay on the interrupted stack
+    slli tp, tp, 3          # t0 is the only free register, scale tp in place
+    la t0, exception_stack_tops
+    add t0, t0, tp
+    srli tp, tp, 3
+    ld t0, 0(t0)
+    sd sp, FULL_SP-FULL_FRAME(t0)   # into the frame save_regs builds
+    mv sp, t0
+    j 2f
+1:
+    sd sp, FULL_SP-FULL_FRAME(sp)
+2:
+    csrr t0, sscratch
     save_regs
-    .cfi_def_cfa sp, 256
-    .cfi_offset ra, -256
-    .cfi_offset s0, -224
+    .cfi_def_cfa sp, FULL_FRAME
+    .cfi_offset ra, -FULL_FRAME
+    .cfi_offset s0, -240    # 32(sp), relative to the CFA
     csrr a0, scause
     csrr a1, sepc
     csrr a2, stval
-    csrr a3, sstatus
+    ld a3, FULL_SSTATUS(sp)
+    ld a4, FULL_CYCLES(sp)
+    ld a5, FULL_SP(sp)
     call kernel_trap_handler
     restore_regs
     .cfi_def_cfa sp, 0
-    restore_caller_stack
     .cfi_endproc
     sret
 
+software_vector:
+    fast_entry kernel_software_trap
+
+timer_vector:
+    fast_entry kernel_timer_trap
+
+external_vector:
+    fast_entry kernel_external_trap
+
+# Vectored mode: exceptions jump to the base, interrupt N to base + 4 * N.
+# Interrupts without a stub of their own take the full path.
+    .align 8
+trap_vector_table:
+    .option push
+    .option norvc
+    j trap_vector       # exceptions
+    j software_vector   # 1: supervisor software
+    j trap_vector
+    j trap_vector
+    j trap_vector
+    j timer_vector      # 5: supervisor timer
+    j trap_vector
+    j trap_vector
+    j trap_vector
+    j external_vector   # 9: supervisor external
+    j trap_vector
+    j trap_vector
+    j trap_vector
+    j trap_vector
+    j trap_vector
+    j trap_vector
+    .option pop
+
 # .section .note.GNU-stack,"",%progbits
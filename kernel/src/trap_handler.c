@@ -1,13 +1,15 @@
 #include "trap_handler.h"
 #include "device/plic.h"
 #include "device/shared.h"
-#include "device/virtio/virtio_mouse.h"
+#include "irq.h"
+#include "lib/deferred.h"
 #include "lib/sbi.h"
 #include "lib/time.h"
 #include "lib/timer.h"
+#include "lib/timer_queue.h"
 #include "physical_alloc.h"
 #include "proc.h"
-#include <device/virtio/virtio_keyboard.h>
+#include "trap_stats.h"
 #include <lib/ansi.h>
 #include <lib/cpu.h>
 #include <lib/print.h>
@@ -16,12 +18,47 @@
 #include <platform/registers.h>
 #include <stdint.h>
 
-// #define TICK_INTERVAL_CYCLES 1000000
-#define TICK_INTERVAL_CYCLES 100000
+extern void trap_vector();
+extern void trap_vector_table();
 
-static uint64_t next_deadline = 0;
+/* stacks kernel exceptions are handled on, one per hart, see trap.s */
+#define EXCEPTION_STACK_SIZE 8192
+static uint8_t exception_stacks[NCPU][EXCEPTION_STACK_SIZE]
+    __attribute__((aligned(16)));
+uint64_t exception_stack_tops[NCPU];
 
-extern void trap_vector();
+void trap_init(void) {
+  for (int i = 0; i < NCPU; i++)
+    exception_stack_tops[i] = (uint64_t)(exception_stacks[i] + EXCEPTION_STACK_SIZE);
+}
+
+#ifdef TRAP_VECTOR_DIRECT
+#define TRAP_VECTOR_MODE "direct"
+#else
+#define TRAP_VECTOR_MODE "vectored"
+#endif
+
+uint64_t kernel_trap_vector(void) {
+#ifdef TRAP_VECTOR_DIRECT
+  return (uint64_t)trap_vector;
+#else
+  return (uint64_t)trap_vector_table | STVEC_MODE_VECTORED;
+#endif
+}
+
+/* scause of the interrupts with their own vector */
+#define SCAUSE_SOFTWARE ((1ULL << 63) | 1)
+#define SCAUSE_TIMER ((1ULL << 63) | 5)
+#define SCAUSE_EXTERNAL ((1ULL << 63) | 9)
+
+/* time from the first instruction of the vector to the C handler */
+static void account_entry(uint64_t entry_cycles) {
+  uint64_t cycles = get_time_in_cycles() - entry_cycles;
+  cpu_t *c = current_cpu();
+
+  c->irq_entries++;
+  c->irq_entry_cycles += cycles;
+}
 
 // Function to get a human-readable cause string
 const char *get_exception_cause_str(uint64_t cause) {
@@ -67,24 +104,28 @@ const char *get_exception_cause_str(uint64_t cause) {
   }
 }
 
-void kernel_trap_handler() {
-  uint64_t sepc = PS_get_exception_pc();
-  uint64_t scause = PS_get_exception_cause();
-  uint64_t stval = PS_get_exception_value();
-  uint64_t sstatus = PS_get_status();
-
+void kernel_trap_handler(uint64_t scause, uint64_t sepc, uint64_t stval,
+                         uint64_t sstatus, uint64_t entry_cycles, uint64_t sp) {
   if (scause & (1ULL << 63)) {
     // Handle interrupt
     uint64_t interrupt_code = scause & 0x7FFFFFFF;
+    account_entry(entry_cycles);
+    trap_count(current_cpu()->proc, scause);
     handle_interrupt(interrupt_code, sepc);
+    tasklet_run_pending();
+    kernel_preempt(sstatus);
   } else {
     // Handle exception
-    exception_handler(scause, sepc, stval, sstatus);
+    trap_count(current_cpu()->proc, scause);
+    exception_handler(scause, sepc, stval, sstatus, sp);
   }
 }
 
 void exception_handler(uint64_t scause, uint64_t sepc, uint64_t stval,
-                       uint64_t sstatus) {
+                       uint64_t sstatus, uint64_t sp) {
+  // halts with interrupts off, nothing would drain the UART ring
+  shared_uart_set_polled();
+
   // Print trap header
   print("\n\n", PRINT_FLAG_BOTH);
   print(
@@ -120,6 +161,21 @@ void exception_handler(uint64_t scause, uint64_t sepc, uint64_t stval,
   print(buffer, PRINT_FLAG_BOTH);
   print("\n", PRINT_FLAG_BOTH);
 
+  // sp when the trap happened, not the exception stack this runs on
+  print(ANSI_APPLY(ANSI_EFFECT_BOLD, "Stack Pointer: "), PRINT_FLAG_BOTH);
+  hexstrfuint(sp, buffer);
+  print("0x", PRINT_FLAG_BOTH);
+  print(buffer, PRINT_FLAG_BOTH);
+  print("\n", PRINT_FLAG_BOTH);
+
+  // A fault just below the kernel stack is an overflow into its guard page
+  proc_t *p = current_cpu()->proc;
+  if (p && p->kstack && stval < p->kstack && stval >= p->kstack - PAGE_SIZE) {
+    printf(ANSI_APPLY(ANSI_EFFECT_BOLD, "Kernel stack overflow: ")
+           "%{type: str} ran into its guard page\n",
+           PRINT_FLAG_BOTH, p->name);
+  }
+
   // Print status register
   print(ANSI_APPLY(ANSI_EFFECT_BOLD, "Status Register: "), PRINT_FLAG_BOTH);
   hexstrfuint(sstatus, buffer);
@@ -165,12 +221,12 @@ void handle_interrupt(uint64_t interrupt_code, uint64_t sepc) {
 
   switch (interrupt_code) {
   case 1: // Supervisor software interrupt
-    print("Supervisor software interrupt\n", PRINT_FLAG_BOTH);
+    software_interrupt();
     break;
   case 5: // Supervisor timer interrupt
           // print("Supervisor timer interrupt\n", PRINT_FLAG_BOTH);
     // print("Kenrnel encountered a timer interrupt\n", PRINT_FLAG_BOTH);
-    sbi_set_timer(get_csrr_time() + TICK_INTERVAL_CYCLES);
+    timer_interrupt();
     break;
   case 9: // Supervisor external interrupt
     handle_external_interrupt();
@@ -182,51 +238,82 @@ void handle_interrupt(uint64_t interrupt_code, uint64_t sepc) {
   }
 }
 
+void kernel_timer_trap(uint64_t sstatus, uint64_t entry_cycles) {
+  account_entry(entry_cycles);
+  trap_count(current_cpu()->proc, SCAUSE_TIMER);
+  timer_interrupt();
+  tasklet_run_pending();
+  kernel_preempt(sstatus);
+}
+
+void kernel_software_trap(uint64_t sstatus, uint64_t entry_cycles) {
+  account_entry(entry_cycles);
+  trap_count(current_cpu()->proc, SCAUSE_SOFTWARE);
+  software_interrupt();
+  tasklet_run_pending();
+  kernel_preempt(sstatus);
+}
+
+void kernel_external_trap(uint64_t sstatus, uint64_t entry_cycles) {
+  account_entry(entry_cycles);
+  trap_count(current_cpu()->proc, SCAUSE_EXTERNAL);
+  handle_external_interrupt();
+  tasklet_run_pending();
+  kernel_preempt(sstatus);
+}
+
+void trap_entry_print_stats(void) {
+  for (int i = 0; i < NCPU; i++) {
+    cpu_t *c = &cpus[i];
+    if (!c->online || !c->irq_entries)
+      continue;
+
+    printf("hart %{type: int}: %{type: int} kernel interrupts, %{type: int} "
+           "cycles from vector to handler (" TRAP_VECTOR_MODE " stvec)\n",
+           PRINT_FLAG_BOTH, i, c->irq_entries,
+           c->irq_entry_cycles / c->irq_entries);
+  }
+}
+
+void kernel_preempt(uint64_t sstatus) {
+  cpu_t *c = current_cpu();
+  proc_t *p = c->proc;
+
+  // only code that ran with interrupts on can be switched out; interrupts
+  // are off in here, so noff counts locks held by the interrupted code
+  if (!(sstatus & SSTATUS_SPIE) || !p || !c->need_resched || !preemptible())
+    return;
+  if (p->state != RUNNING)
+    return;
+
+  c->preemptions++;
+  trap_count_preemption(p);
+  yield(); // the trap frame stays on p's kernel stack until it runs again
+}
+
+void timer_interrupt(void) {
+  cpu_t *c = current_cpu();
+
+  timer_queue_run();
+  sched_timer_tick(c);
+
+  // no periodic tick, only the next timer deadline or timeslice end
+  sched_update_tick(c);
+}
+
+void software_interrupt(void) {
+  // IPI from another hart, e.g. a proc was queued here
+  PS_clear_interrupt_pending(SIE_SOFTWARE);
+  sched_update_tick(current_cpu());
+}
+
 void handle_external_interrupt() {
-  uint32_t irq = shared_plic_claim(0, PLIC_CONTEXT_SUPERVISOR);
+  uint32_t irq = shared_plic_claim(IRQ_HART, PLIC_CONTEXT_SUPERVISOR);
 
   if (irq == 0) { /* spurious or already-handled source   */
-    shared_plic_complete(0, PLIC_CONTEXT_SUPERVISOR, 0);
+    shared_plic_complete(IRQ_HART, PLIC_CONTEXT_SUPERVISOR, 0);
     return;
   }
 
-  // Handle based on IRQ number
-  switch (irq) {
-
-  case 10: // UART IRQ
-    if (shared_uart_initialized) {
-      plic_disable_interrupt(shared_plic, 0, PLIC_CONTEXT_SUPERVISOR, 10);
-      volatile uint8_t *u = (uint8_t *)shared_uart->base;
-
-      (void)u[2]; // read IIR ‑‑ clears the IRQ source
-      // NOTE: IIR bits 0‑3 give the reason (0b010 = Rx, 0b001 = Tx‑empty, …)
-
-      /* drain any pending RX data so the line doesn’t re‑assert immediately */
-      while (true) {
-        if (!(u[5] & 0x01)) // LSR bit0: Data‑Ready?
-          break;
-        char c = u[0];
-        char s[2] = {c, '\0'};
-      }
-      plic_enable_interrupt(shared_plic, 0, PLIC_CONTEXT_SUPERVISOR, 10);
-    }
-    break;
-  case 1:
-    virtio_keyboard_handle_irq(shared_virtio_keyboard);
-    break;
-  case 2:
-    virtio_mouse_handle_irq(shared_virtio_mouse);
-    break;
-  default:
-    printf("Unknown external interrupt: %{type: int}\n", PRINT_FLAG_BOTH, irq);
-    break;
-  }
-
-  // Complete the interrupt handling
-  // TODO: active hart id
-  if (irq != 0) {
-    if (!shared_plic_complete(0, PLIC_CONTEXT_SUPERVISOR, irq)) {
-      panic_msg("Failed to complete PLIC interrupt");
-    }
-  }
+  irq_dispatch(irq);
 }
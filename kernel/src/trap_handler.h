@@ -3,7 +3,41 @@
 #include <stdint.h>
 
 void trap_handler();
+
+/* Human-readable name of exception code `cause`. */
+const char *get_exception_cause_str(uint64_t cause);
 void exception_handler(uint64_t scause, uint64_t sepc, uint64_t stval,
-                       uint64_t sstatus);
+                       uint64_t sstatus, uint64_t sp);
 void handle_interrupt(uint64_t interrupt_code, uint64_t sepc);
 void handle_external_interrupt();
+void timer_interrupt(void);
+
+/*
+ * Called on the way out of a kernel-mode interrupt, `sstatus` being its
+ * value at trap entry. Yields if the interrupted proc's timeslice expired
+ * and it is preemptible (see lib/cpu.h).
+ */
+void kernel_preempt(uint64_t sstatus);
+
+/* Sets up the per-hart stacks kernel exceptions are taken on, see trap.s. */
+void trap_init(void);
+
+/*
+ * The stvec value for kernel mode: trap_vector_table in vectored mode, or
+ * trap_vector in direct mode when built with TRAP_VECTOR_DIRECT. See trap.s.
+ */
+uint64_t kernel_trap_vector(void);
+
+/* C entry points of trap.s */
+void kernel_trap_handler(uint64_t scause, uint64_t sepc, uint64_t stval,
+                         uint64_t sstatus, uint64_t entry_cycles, uint64_t sp);
+void kernel_timer_trap(uint64_t sstatus, uint64_t entry_cycles);
+void kernel_software_trap(uint64_t sstatus, uint64_t entry_cycles);
+void kernel_external_trap(uint64_t sstatus, uint64_t entry_cycles);
+
+/*
+ * Prints the average interrupt entry latency of each hart, in cycles, see
+ * stats_print(). Build once with TRAP_VECTOR_DIRECT to compare the modes.
+ */
+void trap_entry_print_stats(void);
+void software_interrupt(void);
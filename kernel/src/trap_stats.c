@@ -0,0 +1,90 @@
+#include "trap_stats.h"
+#include "lib/print.h"
+#include "lib/usermem.h"
+#include "proc.h"
+#include "trap_handler.h"
+
+#define SCAUSE_INTERRUPT (1ULL << 63)
+
+static trap_counts_t global_counts; /* updated atomically */
+
+static const char *interrupt_str(uint64_t code) {
+  switch (code) {
+  case 1:
+    return "Supervisor software interrupt";
+  case 5:
+    return "Supervisor timer interrupt";
+  case 9:
+    return "Supervisor external interrupt";
+  default:
+    return "Interrupt";
+  }
+}
+
+void trap_count(proc_t *p, uint64_t scause) {
+  uint64_t code = scause & ~SCAUSE_INTERRUPT;
+  if (code >= TRAP_CAUSES)
+    code = TRAP_CAUSES - 1;
+
+  uint64_t *global = (scause & SCAUSE_INTERRUPT)
+                         ? &global_counts.interrupts[code]
+                         : &global_counts.exceptions[code];
+  __atomic_fetch_add(global, 1, __ATOMIC_RELAXED);
+
+  // only the hart running p touches its counters
+  if (p) {
+    if (scause & SCAUSE_INTERRUPT)
+      p->traps.interrupts[code]++;
+    else
+      p->traps.exceptions[code]++;
+  }
+}
+
+void trap_count_preemption(proc_t *p) {
+  __atomic_fetch_add(&global_counts.preemptions, 1, __ATOMIC_RELAXED);
+  if (p)
+    p->traps.preemptions++;
+}
+
+RESULT_TYPE(uint64_t)
+trap_stats_copyout(proc_t *p, uint64_t which, uint64_t addr, uint64_t len) {
+  trap_counts_t snapshot;
+
+  switch (which) {
+  case TRAP_STATS_SELF:
+    snapshot = p->traps;
+    break;
+  case TRAP_STATS_GLOBAL:
+    snapshot = global_counts;
+    break;
+  default:
+    return RESULT_FAILURE(RESULT_INVALID);
+  }
+
+  if (len > sizeof(snapshot))
+    len = sizeof(snapshot);
+  result_t r = copyout(p->pagetable, addr, &snapshot, len);
+  if (!result_is_ok(r))
+    return r;
+
+  return RESULT_SUCCESS(len);
+}
+
+void trap_counts_print(const char *name, const trap_counts_t *t) {
+  printf("traps of %{type: str}:\n", PRINT_FLAG_UART, name);
+
+  for (int i = 0; i < TRAP_CAUSES; i++) {
+    if (t->exceptions[i])
+      printf("  %{type: str}: %{type: int}\n", PRINT_FLAG_UART,
+             get_exception_cause_str(i), t->exceptions[i]);
+  }
+  for (int i = 0; i < TRAP_CAUSES; i++) {
+    if (t->interrupts[i])
+      printf("  %{type: str} %{type: int}: %{type: int}\n", PRINT_FLAG_UART,
+             interrupt_str(i), i, t->interrupts[i]);
+  }
+  if (t->preemptions)
+    printf("  preemptions: %{type: int}\n", PRINT_FLAG_UART, t->preemptions);
+}
+
+void trap_stats_print(void) { trap_counts_print("all procs", &global_counts); }
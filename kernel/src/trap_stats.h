@@ -0,0 +1,52 @@
+#pragma once
+/*
+ * Trap accounting.
+ *
+ * Every trap is counted by its scause code, both for the proc it was taken
+ * in (kernel-mode interrupts count against the proc running on the hart) and
+ * in a global total. SYS_TRAP_STATS copies either set of counters out as a
+ * trap_counts_t, and trap_counts_print() dumps them to the UART. The global
+ * ones are part of stats_print(); building with TRAP_STATS_ON_EXIT also
+ * dumps each proc's counters when it exits.
+ */
+
+#include <lib/result.h>
+#include <lib/types.h>
+#include <stdint.h>
+
+typedef struct proc proc_t;
+
+/* scause codes counted, larger ones are folded into the last slot */
+#define TRAP_CAUSES 16
+
+/* SYS_TRAP_STATS a0 */
+#define TRAP_STATS_SELF 0
+#define TRAP_STATS_GLOBAL 1
+
+typedef struct trap_counts {
+  uint64_t exceptions[TRAP_CAUSES]; /* by exception code: 8 = syscalls,
+                                       12/13/15 = page faults */
+  uint64_t interrupts[TRAP_CAUSES]; /* by interrupt code: 5 = timer,
+                                       9 = external */
+  uint64_t preemptions;             /* switched out at the end of a slice */
+} trap_counts_t;
+
+/* Counts a trap with cause `scause` against `p`, which may be NULL. */
+void trap_count(proc_t *p, uint64_t scause);
+
+/* Counts a timeslice preemption of `p`. */
+void trap_count_preemption(proc_t *p);
+
+/*
+ * Copies the counters of `p` (TRAP_STATS_SELF) or the global ones
+ * (TRAP_STATS_GLOBAL) to user address `addr`, at most `len` bytes. Returns
+ * the number of bytes copied.
+ */
+RESULT_TYPE(uint64_t)
+trap_stats_copyout(proc_t *p, uint64_t which, uint64_t addr, uint64_t len);
+
+/* Prints the non-zero counters of `t` to the UART, headed by `name`. */
+void trap_counts_print(const char *name, const trap_counts_t *t);
+
+/* trap_counts_print() of the global counters. */
+void trap_stats_print(void);
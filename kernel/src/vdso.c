@@ -0,0 +1,57 @@
+#include "vdso.h"
+#include "lib/memory.h"
+#include "lib/spinlock.h"
+#include "lib/timer.h"
+#include "mem_layout.h"
+#include <device/shared.h>
+#include <lib/panic.h>
+#include <physical_alloc.h>
+
+static vdso_time_t *vdso_data;
+static struct spinlock vdso_lock; /* serialises writers */
+
+static uint64_t ticks_to_ns(uint64_t ticks) {
+  return (ticks / TIMER_FREQUENCY) * 1000000000ULL +
+         (ticks % TIMER_FREQUENCY) * 1000000000ULL / TIMER_FREQUENCY;
+}
+
+void vdso_init(void) {
+  // a whole page, nothing else of the kernel's may become user readable
+  vdso_data = alloc_page();
+  if (!vdso_data)
+    panic("vdso_init: out of memory");
+  memset(vdso_data, 0, PAGE_SIZE);
+
+  initlock(&vdso_lock, "vdso");
+  vdso_data->timebase_hz = TIMER_FREQUENCY;
+
+  // the goldfish RTC counts nanoseconds since the epoch
+  if (shared_rtc_initialized)
+    vdso_set_realtime(shared_rtc_get_time());
+}
+
+void vdso_set_realtime(uint64_t ns) {
+  acquire(&vdso_lock);
+
+  __atomic_store_n(&vdso_data->seq, vdso_data->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  vdso_data->realtime_offset_ns = ns - ticks_to_ns(get_csrr_time());
+
+  __atomic_store_n(&vdso_data->seq, vdso_data->seq + 1, __ATOMIC_RELEASE);
+
+  release(&vdso_lock);
+}
+
+g_bool vdso_map(page_table_t *pt) {
+  if (!map_page(pt, VDSO_DATA, V2P((uint64_t)vdso_data), PTE_R | PTE_U | PTE_V))
+    return false;
+
+  if (!map_page(pt, VDSO_TEXT, V2P((uint64_t)vdso_start),
+                PTE_R | PTE_X | PTE_U | PTE_V)) {
+    unmap_page(pt, VDSO_DATA);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+/*
+ * vDSO time page.
+ *
+ * Every user address space maps two kernel pages: VDSO_DATA, a read-only
+ * vdso_time_t, and VDSO_TEXT, the routines in vdso.S. Those routines read
+ * the `time` CSR directly, so a proc can query the clock without trapping.
+ * Call them at VDSO_TEXT + (symbol - vdso_start).
+ *
+ * The kernel updates the data page under a seqlock. `seq` is odd while an
+ * update is in progress. A reader retries if `seq` was odd or changed
+ * across its reads.
+ */
+
+#include <lib/types.h>
+#include <page_table.h>
+
+typedef struct vdso_time {
+  uint32_t seq;                /* seqlock version, odd while updating */
+  uint32_t reserved;
+  uint64_t timebase_hz;        /* rate of the `time` CSR */
+  uint64_t realtime_offset_ns; /* wall clock time at `time` == 0 */
+} vdso_time_t;
+
+/* vdso.S, user code */
+extern char vdso_start[];
+extern char vdso_clock_monotonic_ns[];
+extern char vdso_clock_realtime_ns[];
+
+/*
+ * Allocates the data page and sets the wall clock from the RTC if it is up.
+ * Lets user mode read `time` on this hart. Called once at boot.
+ */
+void vdso_init(void);
+
+/* Sets the wall clock to `ns` since the epoch, as of now. */
+void vdso_set_realtime(uint64_t ns);
+
+/* Maps both vDSO pages into a user page table. */
+g_bool vdso_map(page_table_t *pt);